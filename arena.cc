@@ -0,0 +1,109 @@
+#include "arena.hh"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+
+
+static arena __default_ast_arena;
+static thread_local arena* __ast_arena = nullptr;
+
+arena* get_ast_arena()
+{
+    return __ast_arena ? __ast_arena : &__default_ast_arena;
+}
+
+void set_ast_arena(arena* ast_arena)
+{
+    __ast_arena = ast_arena;
+}
+
+
+static char* align_up(char* ptr, size_t alignment)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+    address = (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    return reinterpret_cast<char*>(address);
+}
+
+
+arena::arena(size_t size) : block_size(size)
+{}
+
+arena::~arena()
+{
+    reset();
+
+    while (blocks)
+    {
+        block* temp = blocks;
+        blocks = blocks->next;
+        free(temp);
+    }
+}
+
+arena::block* arena::new_block(size_t size)
+{
+    block* b = static_cast<block*>(malloc(sizeof(block) + size));
+    if (!b)
+    {
+        fprintf(stderr, "[ERROR] Out of memory.\n");
+        abort();
+    }
+    b->next = nullptr;
+    b->size = size;
+    return b;
+}
+
+void* arena::allocate(size_t size, size_t alignment)
+{
+    char* ptr = align_up(cursor, alignment);
+
+    if (cursor && ptr + size <= limit)
+    {
+        cursor = ptr + size;
+        return ptr;
+    }
+
+    // Requests that would waste most of a block get one of their own.
+    if (size + alignment > block_size / 4)
+    {
+        block* b = new_block(size + alignment);
+        b->next = large_blocks;
+        large_blocks = b;
+        return align_up(reinterpret_cast<char*>(b + 1), alignment);
+    }
+
+    // Move on to the next block, reusing one left over from a reset.
+    if (!current)
+    {
+        if (!blocks) blocks = new_block(block_size);
+        current = blocks;
+    }
+    else
+    {
+        if (!current->next) current->next = new_block(block_size);
+        current = current->next;
+    }
+
+    cursor = reinterpret_cast<char*>(current + 1);
+    limit = cursor + current->size;
+
+    ptr = align_up(cursor, alignment);
+    cursor = ptr + size;
+    return ptr;
+}
+
+void arena::reset()
+{
+    while (large_blocks)
+    {
+        block* temp = large_blocks;
+        large_blocks = large_blocks->next;
+        free(temp);
+    }
+
+    current = nullptr;
+    cursor = nullptr;
+    limit = nullptr;
+}
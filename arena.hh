@@ -0,0 +1,53 @@
+#ifndef KS_ARENA_HH
+#define KS_ARENA_HH
+
+#include <cstddef>
+#include <new>
+
+
+// Bump allocator owning everything built for one command: AST nodes,
+// their lists and the lexemes they point to. Nothing allocated from it
+// is destroyed individually; reset() releases it all at once and keeps
+// the blocks around for the next command.
+class arena
+{
+public:
+    explicit arena(size_t block_size = 64 * 1024);
+    ~arena();
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    void reset();
+
+    template <class T>
+    T* make()
+    {
+        return new (allocate(sizeof(T), alignof(T))) T();
+    }
+
+protected:
+    struct block
+    {
+        block* next {nullptr};
+        size_t size {};
+    };
+
+    block* new_block(size_t);
+
+    size_t block_size {};
+    block* blocks {nullptr}; // fixed-size blocks, reused after reset()
+    block* current {nullptr};
+    block* large_blocks {nullptr}; // oversized requests, freed on reset()
+    char* cursor {nullptr};
+    char* limit {nullptr};
+};
+
+// The arena owning the AST of the command being parsed: that of the
+// compiler instance active on the calling thread
+arena* get_ast_arena();
+void set_ast_arena(arena*); // nullptr for the default one
+
+
+#endif // KS_ARENA_HH
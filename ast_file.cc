@@ -0,0 +1,545 @@
+#include "ast_file.hh"
+#include "arena.hh"
+#include "compiler_instance.hh"
+#include "symbol_table.hh"
+#include "utility.hh"
+#include "trace.hh"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+enum node_kind : unsigned char
+{
+    kind_number = 1,
+    kind_variable,
+    kind_binary,
+    kind_call,
+    kind_declaration,
+    kind_definition,
+    kind_block,
+    kind_assignment,
+    kind_index,
+    kind_if_else,
+    kind_for_loop,
+};
+
+static const char magic[4] = {'K', 'A', 'S', 'T'};
+static const size_t header_size = 32;
+
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static const uint64_t fnv1a_basis = 14695981039346656037ull;
+
+static void put_le(unsigned char* out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static void append_varint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+static uint64_t get_le(const unsigned char* in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+
+int ast_writer_visitor::initialize(const char* filename)
+{
+    this->filename = filename;
+    names.clear();
+    commands.clear();
+    indices.clear();
+    name_count = 0;
+    command_count = 0;
+    return 0;
+}
+
+int ast_writer_visitor::terminate()
+{
+    trace_scope scope("emit", "write AST");
+
+    unsigned char header[header_size] = {};
+    uint64_t checksum = fnv1a(fnv1a_basis, (const unsigned char*)names.data(), names.size());
+    checksum = fnv1a(checksum, (const unsigned char*)commands.data(), commands.size());
+    memcpy(header, magic, sizeof(magic));
+    put_le(header + 4, ast_file_version, 4);
+    put_le(header + 8, checksum, 8);
+    put_le(header + 16, name_count, 4);
+    put_le(header + 20, command_count, 4);
+    put_le(header + 24, names.size() + commands.size(), 8);
+
+    FILE* fd = fopen(filename.c_str(), "wb");
+    if (!fd)
+    {
+        fprintf(stderr, "[ERROR] Cannot open file \"%s\".\n", filename.c_str());
+        return 1;
+    }
+    bool written = fwrite(header, 1, header_size, fd) == header_size
+        && fwrite(names.data(), 1, names.size(), fd) == names.size()
+        && fwrite(commands.data(), 1, commands.size(), fd) == commands.size();
+    if (fclose(fd) != 0 || !written)
+    {
+        fprintf(stderr, "[ERROR] Cannot write file \"%s\".\n", filename.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+void ast_writer_visitor::add_varint(uint64_t value)
+{
+    append_varint(commands, value);
+}
+
+void ast_writer_visitor::add_node(unsigned char kind, ast_node* node)
+{
+    commands += (char)kind;
+    add_varint((uint32_t)node->row);
+    add_varint((uint32_t)node->col);
+}
+
+void ast_writer_visitor::add_symbol(int symbol)
+{
+    // Names are written the first time they are used.
+    if (indices.size() <= (size_t)symbol) indices.resize(symbol_count() + 1, -1);
+    if (indices[symbol] < 0)
+    {
+        indices[symbol] = name_count++;
+        const char* name = symbol_name(symbol);
+        size_t length = strlen(name);
+        append_varint(names, length);
+        names.append(name, length + 1); // with the NUL
+    }
+    add_varint(indices[symbol]);
+}
+
+int ast_writer_visitor::visit(top_level_node* node)
+{
+    if (!node->content) return 0;
+    ++command_count;
+    return node->content->accept(this);
+}
+
+int ast_writer_visitor::visit(number_node* node)
+{
+    add_node(kind_number, node);
+    uint64_t bits;
+    memcpy(&bits, &node->number, sizeof(bits));
+    unsigned char number[8];
+    put_le(number, bits, 8);
+    commands.append((const char*)number, sizeof(number));
+    add_varint(node->length);
+    commands.append(node->value, node->length);
+    commands += '\0'; // the lexeme is used in place when read
+    return 0;
+}
+
+int ast_writer_visitor::visit(variable_node* node)
+{
+    add_node(kind_variable, node);
+    add_symbol(node->name);
+    commands += (char)node->is_array;
+    return 0;
+}
+
+int ast_writer_visitor::visit(binary_expression_node* node)
+{
+    add_node(kind_binary, node);
+    commands += node->operation;
+    node->lhs->accept(this);
+    return node->rhs->accept(this);
+}
+
+int ast_writer_visitor::visit(call_function_node* node)
+{
+    add_node(kind_call, node);
+    add_symbol(node->callee);
+    add_varint(node->arguments->size());
+    for (ast_node* child : *node->arguments)
+        child->accept(this);
+    return 0;
+}
+
+int ast_writer_visitor::visit(function_declaration_node* node)
+{
+    add_node(kind_declaration, node);
+    add_symbol(node->name);
+    add_varint(node->arguments->size());
+    for (variable_node* child : *node->arguments)
+        child->accept(this);
+    return 0;
+}
+
+int ast_writer_visitor::visit(function_definition_node* node)
+{
+    add_node(kind_definition, node);
+    node->declaration->accept(this);
+    return node->definition->accept(this);
+}
+
+int ast_writer_visitor::visit(block_node* node)
+{
+    add_node(kind_block, node);
+    add_varint(node->expressions->size());
+    for (ast_node* child : *node->expressions)
+        child->accept(this);
+    return 0;
+}
+
+int ast_writer_visitor::visit(assignment_node* node)
+{
+    add_node(kind_assignment, node);
+    add_symbol(node->variable);
+    return node->expression->accept(this);
+}
+
+int ast_writer_visitor::visit(index_node* node)
+{
+    add_node(kind_index, node);
+    add_symbol(node->array);
+    commands += (char)(node->value != nullptr);
+    node->index->accept(this);
+    return node->value ? node->value->accept(this) : 0;
+}
+
+int ast_writer_visitor::visit(if_else_node* node)
+{
+    add_node(kind_if_else, node);
+    node->condition->accept(this);
+    node->then_expr->accept(this);
+    return node->else_expr->accept(this);
+}
+
+int ast_writer_visitor::visit(for_loop_node* node)
+{
+    add_node(kind_for_loop, node);
+    node->init->accept(this);
+    node->cond->accept(this);
+    node->step->accept(this);
+    return node->expr->accept(this);
+}
+
+
+ast_file_reader::~ast_file_reader()
+{
+    if (data) munmap((void*)data, size);
+}
+
+int ast_file_reader::open(const char* filename)
+{
+    trace_scope scope("frontend", "map AST");
+    this->filename = filename;
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(diagnostic_stream(), "[ERROR] Cannot open file \"%s\".\n", filename);
+        return 1;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < header_size)
+    {
+        close(fd);
+        fprintf(diagnostic_stream(), "[ERROR] \"%s\" is not an AST file.\n", filename);
+        return 1;
+    }
+    size = status.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(diagnostic_stream(), "[ERROR] Cannot map file \"%s\".\n", filename);
+        return 1;
+    }
+    data = (const unsigned char*)mapping;
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    if (memcmp(data, magic, sizeof(magic)) != 0)
+    {
+        fprintf(diagnostic_stream(), "[ERROR] \"%s\" is not an AST file.\n", filename);
+        return 1;
+    }
+    uint32_t version = get_le(data + 4, 4);
+    if (version != ast_file_version)
+    {
+        fprintf(diagnostic_stream(), "[ERROR] \"%s\" has AST format %u, this compiler reads %u; emit it again.\n",
+            filename, version, ast_file_version);
+        return 1;
+    }
+    if (get_le(data + 24, 8) != size - header_size)
+    {
+        fprintf(diagnostic_stream(), "[ERROR] \"%s\" is truncated.\n", filename);
+        return 1;
+    }
+    if (get_le(data + 8, 8) != fnv1a(fnv1a_basis, data + header_size, size - header_size))
+    {
+        fprintf(diagnostic_stream(), "[ERROR] \"%s\" is corrupt (checksum mismatch).\n", filename);
+        return 1;
+    }
+
+    cursor = data + header_size;
+    end = data + size;
+    command_count = get_le(data + 20, 4);
+
+    uint32_t name_count = get_le(data + 16, 4);
+    symbols.clear();
+    for (uint32_t i = 0; i < name_count && !failed; ++i)
+    {
+        uint64_t length = read_varint();
+        if (length >= (uint64_t)(end - cursor) || cursor[length] != '\0')
+            return fail();
+        symbols.push_back(intern_symbol((const char*)cursor, length));
+        cursor += length + 1;
+    }
+    return failed;
+}
+
+int ast_file_reader::run(compiler_instance& instance)
+{
+    instance_scope scope(&instance);
+    top_level_node& root = instance.root;
+
+    for (uint32_t i = 0; i < command_count; ++i)
+    {
+        {
+            trace_scope scope("frontend", "load");
+            int kind = cursor < end ? *cursor : -1;
+            if (kind == kind_declaration)
+                root.content = read_declaration();
+            else if (kind == kind_definition)
+                root.content = read_node();
+            else
+                return fail();
+            if (!root.content)
+                return 1;
+        }
+
+        instance.hand_over(); // as the parser does
+    }
+
+    return cursor == end ? 0 : fail();
+}
+
+int ast_file_reader::fail()
+{
+    if (!failed)
+        fprintf(diagnostic_stream(), "[ERROR] \"%s\" is corrupt.\n", filename.c_str());
+    failed = true;
+    return 1;
+}
+
+int ast_file_reader::read_byte()
+{
+    if (cursor == end) { fail(); return -1; }
+    return *cursor++;
+}
+
+uint64_t ast_file_reader::read_varint()
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = read_byte();
+        if (byte < 0) return 0;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) return value;
+    }
+    fail();
+    return 0;
+}
+
+int ast_file_reader::read_symbol()
+{
+    uint64_t index = read_varint();
+    if (index >= symbols.size())
+    {
+        fail();
+        return empty_symbol;
+    }
+    return symbols[index];
+}
+
+variable_node* ast_file_reader::read_variable()
+{
+    if (read_byte() != kind_variable) { fail(); return nullptr; }
+    int row = read_varint(), col = read_varint();
+    variable_node* node = make_variable_node(read_symbol());
+    node->row = row;
+    node->col = col;
+    node->is_array = read_byte() == 1;
+    return failed ? nullptr : node;
+}
+
+function_declaration_node* ast_file_reader::read_declaration()
+{
+    if (read_byte() != kind_declaration) { fail(); return nullptr; }
+    int row = read_varint(), col = read_varint();
+    int name = read_symbol();
+    uint64_t count = read_varint();
+    if (failed || count > (uint64_t)(end - cursor)) { fail(); return nullptr; } // a node takes a few bytes at least
+
+    small_vector<variable_node*>* arguments = make_small_vector<variable_node*>(get_ast_arena());
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        variable_node* argument = read_variable();
+        if (!argument) return nullptr;
+        arguments->push_back(argument);
+    }
+
+    function_declaration_node* node = make_function_declaration_node(name, arguments);
+    node->row = row;
+    node->col = col;
+    return node;
+}
+
+ast_node* ast_file_reader::read_node()
+{
+    const unsigned char* start = cursor;
+    int kind = read_byte();
+    if (kind == kind_variable || kind == kind_declaration)
+    {
+        cursor = start;
+        return kind == kind_variable ? (ast_node*)read_variable() : (ast_node*)read_declaration();
+    }
+
+    int row = read_varint(), col = read_varint();
+    if (failed) return nullptr;
+
+    ast_node* node {nullptr};
+    switch (kind)
+    {
+    case kind_number:
+    {
+        if (end - cursor < 8) { fail(); return nullptr; }
+        uint64_t bits = get_le(cursor, 8);
+        cursor += 8;
+        uint64_t length = read_varint();
+        if (failed || length >= (uint64_t)(end - cursor) || cursor[length] != '\0') { fail(); return nullptr; }
+        number_node* number = get_ast_arena()->make<number_node>();
+        memcpy(&number->number, &bits, sizeof(bits));
+        number->value = (const char*)cursor; // in the mapping
+        number->length = (unsigned)length;
+        cursor += length + 1;
+        node = number;
+        break;
+    }
+    case kind_binary:
+    {
+        char operation = (char)read_byte();
+        ast_node* lhs = read_node();
+        ast_node* rhs = lhs ? read_node() : nullptr;
+        if (!rhs) return nullptr;
+        node = make_binary_expression_node(lhs, rhs, operation);
+        break;
+    }
+    case kind_call:
+    {
+        int callee = read_symbol();
+        uint64_t count = read_varint();
+        if (failed || count > (uint64_t)(end - cursor)) { fail(); return nullptr; }
+        small_vector<ast_node*>* arguments = make_small_vector<ast_node*>(get_ast_arena());
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            ast_node* argument = read_node();
+            if (!argument) return nullptr;
+            arguments->push_back(argument);
+        }
+        node = make_call_function_node(callee, arguments);
+        break;
+    }
+    case kind_definition:
+    {
+        function_declaration_node* declaration = read_declaration();
+        ast_node* definition = declaration ? read_node() : nullptr;
+        if (!definition) return nullptr;
+        node = make_function_definition_node(declaration, definition);
+        break;
+    }
+    case kind_block:
+    {
+        uint64_t count = read_varint();
+        if (failed || count > (uint64_t)(end - cursor)) { fail(); return nullptr; }
+        small_vector<ast_node*>* expressions = make_small_vector<ast_node*>(get_ast_arena());
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            ast_node* expression = read_node();
+            if (!expression) return nullptr;
+            expressions->push_back(expression);
+        }
+        node = make_block_node(expressions);
+        break;
+    }
+    case kind_assignment:
+    {
+        int variable = read_symbol();
+        ast_node* expression = failed ? nullptr : read_node();
+        if (!expression) return nullptr;
+        node = make_assignment_node(variable, expression);
+        break;
+    }
+    case kind_index:
+    {
+        int array = read_symbol();
+        int has_value = read_byte();
+        ast_node* index = failed ? nullptr : read_node();
+        if (!index) return nullptr;
+        ast_node* value {nullptr};
+        if (has_value == 1 && !(value = read_node())) return nullptr;
+        node = make_index_node(array, index, value);
+        break;
+    }
+    case kind_if_else:
+    {
+        ast_node* condition = read_node();
+        ast_node* then_expr = condition ? read_node() : nullptr;
+        ast_node* else_expr = then_expr ? read_node() : nullptr;
+        if (!else_expr) return nullptr;
+        node = make_if_else_node(condition, then_expr, else_expr);
+        break;
+    }
+    case kind_for_loop:
+    {
+        ast_node* init = read_node();
+        ast_node* cond = init ? read_node() : nullptr;
+        ast_node* step = cond ? read_node() : nullptr;
+        ast_node* expr = step ? read_node() : nullptr;
+        if (!expr) return nullptr;
+        node = make_for_loop_node(init, cond, step, expr);
+        break;
+    }
+    default:
+        fail();
+        return nullptr;
+    }
+
+    if (failed) return nullptr;
+    node->row = row;
+    node->col = col;
+    return node;
+}
@@ -0,0 +1,96 @@
+#ifndef KS_AST_FILE_HH
+#define KS_AST_FILE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "visitor.hh"
+
+struct compiler_instance;
+
+
+// Binary AST files (.kast): the parsed commands of a source, so that a later
+// run compiles them without lexing and parsing again.
+//
+// The file is a 32-byte header followed by the payload:
+//
+//   "KAST", u32 version, u64 checksum (FNV-1a of the payload),
+//   u32 symbol count, u32 command count, u64 payload size
+//
+// The payload holds the names (varint length, bytes, NUL), then each command
+// as its nodes in prefix order: a kind byte, row and column as varints, the
+// fields of the node and its children. Names are referred to by their index
+// in the file, there are no pointers or offsets, and integers in the header
+// are little-endian.
+
+// Bumped whenever the encoding changes; older files are rejected
+const uint32_t ast_file_version = 1;
+
+
+// Writes the commands visited to a .kast file, once terminate() is called
+class ast_writer_visitor : public visitor
+{
+public:
+    int initialize(const char* filename);
+    int terminate();
+
+    virtual int visit(top_level_node*);
+    virtual int visit(number_node*);
+    virtual int visit(variable_node*);
+    virtual int visit(binary_expression_node*);
+    virtual int visit(call_function_node*);
+    virtual int visit(function_declaration_node*);
+    virtual int visit(function_definition_node*);
+    virtual int visit(block_node*);
+    virtual int visit(assignment_node*);
+    virtual int visit(index_node*);
+    virtual int visit(if_else_node*);
+    virtual int visit(for_loop_node*);
+
+protected:
+    void add_node(unsigned char kind, ast_node*);
+    void add_varint(uint64_t);
+    void add_symbol(int);
+
+    std::string filename;
+    std::string names;    // the names section
+    std::string commands; // the commands section
+    std::vector<int> indices; // in the file by symbol id, -1 if not written yet
+    uint32_t name_count {};
+    uint32_t command_count {};
+};
+
+
+// Maps a .kast file and hands its commands one by one to the folder and the
+// visitor of an instance, as its parser does. The lexemes of the numbers
+// point into the mapping, which lasts as long as the reader.
+class ast_file_reader
+{
+public:
+    ~ast_file_reader();
+
+    int open(const char* filename); // checks the header and the checksum
+    int run(compiler_instance&);
+
+protected:
+    ast_node* read_node();
+    variable_node* read_variable();
+    function_declaration_node* read_declaration();
+    uint64_t read_varint();
+    int read_symbol();
+    int read_byte();
+    int fail(); // reports the file as corrupt once
+
+    std::string filename;
+    const unsigned char* data {nullptr};
+    size_t size {};
+    const unsigned char* cursor {nullptr};
+    const unsigned char* end {nullptr};
+    uint32_t command_count {};
+    std::vector<int> symbols; // ids by index in the file
+    bool failed {};
+};
+
+
+#endif // KS_AST_FILE_HH
@@ -1,9 +1,21 @@
 #include "ast_node.hh"
 
+#include "arena.hh"
 #include "visitor.hh"
+#include "utility.hh"
+#include "compiler_instance.hh"
 
-extern int yylineno;
-extern int yycolumn;
+#include <cstdio>
+#include <cstdlib>
+
+
+// Where the scanner of the instance parsing on this thread is
+static void set_position(ast_node* node)
+{
+    compiler_instance* instance = current_instance();
+    node->row = instance ? instance->line() : 0;
+    node->col = instance ? instance->column() : 0;
+}
 
 
 int top_level_node::accept(visitor* visitor)
@@ -51,6 +63,11 @@ int assignment_node::accept(visitor* visitor)
     return visitor->visit(this);
 }
 
+int index_node::accept(visitor* visitor)
+{
+    return visitor->visit(this);
+}
+
 int if_else_node::accept(visitor* visitor)
 {
     return visitor->visit(this);
@@ -62,29 +79,37 @@ int for_loop_node::accept(visitor* visitor)
 }
 
 
-number_node* make_number_node(const char* text)
+number_node* make_number_node(const char* lexeme, size_t length, double number)
 {
-    number_node* node = new number_node();
+    number_node* node = get_ast_arena()->make<number_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
-        node->value = text;
+        set_position(node);
+        node->value = lexeme;
+        node->length = (unsigned)length;
+        node->number = number;
     }
 
     return node;
 }
 
-variable_node* make_variable_node(const char* text)
+number_node* make_number_node(double number)
 {
-    variable_node* node = new variable_node();
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%.17g", number); // reads back as the same double
+
+    return make_number_node(make_c_str(text), length, number);
+}
+
+variable_node* make_variable_node(int name)
+{
+    variable_node* node = get_ast_arena()->make<variable_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
-        node->name = text;
+        set_position(node);
+        node->name = name;
     }
 
     return node;
@@ -92,12 +117,11 @@ variable_node* make_variable_node(const char* text)
 
 binary_expression_node* make_binary_expression_node(ast_node* lhs, ast_node* rhs, char operation)
 {
-    binary_expression_node* node = new binary_expression_node();
+    binary_expression_node* node = get_ast_arena()->make<binary_expression_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
+        set_position(node);
         node->lhs = lhs;
         node->rhs = rhs;
         node->operation = operation;
@@ -106,30 +130,28 @@ binary_expression_node* make_binary_expression_node(ast_node* lhs, ast_node* rhs
     return node;
 }
 
-call_function_node* make_call_function_node(const char* text, double_linked_list_node<ast_node*>* nodes)
+call_function_node* make_call_function_node(int callee, small_vector<ast_node*>* nodes)
 {
-    call_function_node* node = new call_function_node();
+    call_function_node* node = get_ast_arena()->make<call_function_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
-        node->callee = text;
+        set_position(node);
+        node->callee = callee;
         node->arguments = nodes;
     }
 
     return node;
 }
 
-function_declaration_node* make_function_declaration_node(const char* text, double_linked_list_node<variable_node*>* nodes)
+function_declaration_node* make_function_declaration_node(int name, small_vector<variable_node*>* nodes)
 {
-    function_declaration_node* node = new function_declaration_node();
+    function_declaration_node* node = get_ast_arena()->make<function_declaration_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
-        node->name = text;
+        set_position(node);
+        node->name = name;
         node->arguments = nodes;
     }
 
@@ -138,12 +160,11 @@ function_declaration_node* make_function_declaration_node(const char* text, doub
 
 function_definition_node* make_function_definition_node(function_declaration_node* declaration, ast_node* definition)
 {
-    function_definition_node* node = new function_definition_node();
+    function_definition_node* node = get_ast_arena()->make<function_definition_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
+        set_position(node);
         node->declaration = declaration;
         node->definition = definition;
     }
@@ -151,43 +172,55 @@ function_definition_node* make_function_definition_node(function_declaration_nod
     return node;
 }
 
-block_node* make_block_node(double_linked_list_node<ast_node*>* nodes)
+block_node* make_block_node(small_vector<ast_node*>* nodes)
 {
-    block_node* node = new block_node();
+    block_node* node = get_ast_arena()->make<block_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
+        set_position(node);
         node->expressions = nodes;
     }
 
     return node;
 }
 
-assignment_node* make_assignment_node(const char* text, ast_node* expression)
+assignment_node* make_assignment_node(int variable, ast_node* expression)
 {
-    assignment_node* node = new assignment_node();
+    assignment_node* node = get_ast_arena()->make<assignment_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
-        node->variable = text;
+        set_position(node);
+        node->variable = variable;
         node->expression = expression;
     }
 
     return node;
 }
 
+index_node* make_index_node(int array, ast_node* index, ast_node* value)
+{
+    index_node* node = get_ast_arena()->make<index_node>();
+
+    if (node)
+    {
+        set_position(node);
+        node->array = array;
+        node->index = index;
+        node->value = value;
+    }
+
+    return node;
+}
+
 if_else_node* make_if_else_node(ast_node* condition, ast_node* then_expr, ast_node* else_expr)
 {
-    if_else_node* node = new if_else_node();
+    if_else_node* node = get_ast_arena()->make<if_else_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
+        set_position(node);
         node->condition = condition;
         node->then_expr = then_expr;
         node->else_expr = else_expr;
@@ -198,12 +231,11 @@ if_else_node* make_if_else_node(ast_node* condition, ast_node* then_expr, ast_no
 
 for_loop_node* make_for_loop_node(ast_node* init, ast_node* cond, ast_node* step, ast_node* expr)
 {
-    for_loop_node* node = new for_loop_node();
+    for_loop_node* node = get_ast_arena()->make<for_loop_node>();
 
     if (node)
     {
-        node->row = yylineno;
-        node->col = yycolumn;
+        set_position(node);
         node->init = init;
         node->cond = cond;
         node->step = step;
@@ -1,7 +1,7 @@
 #ifndef KS_AST_NODE_HH
 #define KS_AST_NODE_HH
 
-#include "linked_list.hh"
+#include "small_vector.hh"
 
 
 class visitor;
@@ -28,7 +28,9 @@ struct number_node : public ast_node
 {
     virtual int accept(visitor*);
 
-    const char* value {nullptr};
+    const char* value {nullptr}; // lexeme, in place in the source: not null-terminated
+    unsigned length {};          // of the lexeme
+    double number {};            // its value, decoded once by the lexer
 };
 
 
@@ -36,7 +38,8 @@ struct variable_node : public ast_node
 {
     virtual int accept(visitor*);
 
-    const char* name {nullptr};
+    int name {}; // interned symbol id
+    bool is_array {}; // parameter declared as name[], a pointer to doubles
 };
 
 
@@ -54,8 +57,8 @@ struct call_function_node : public ast_node
 {
     virtual int accept(visitor*);
 
-    const char* callee {nullptr}; // the name of the function called
-    double_linked_list_node<ast_node*>* arguments {nullptr};
+    int callee {}; // symbol id of the function called
+    small_vector<ast_node*>* arguments {nullptr};
 };
 
 
@@ -63,8 +66,8 @@ struct function_declaration_node : public ast_node
 {
     virtual int accept(visitor*);
 
-    const char* name {nullptr}; // function name (use "" for anonymous expression)
-    double_linked_list_node<variable_node*>* arguments {nullptr};
+    int name {}; // symbol id of the function name (empty_symbol for anonymous expression)
+    small_vector<variable_node*>* arguments {nullptr};
 };
 
 
@@ -81,7 +84,7 @@ struct block_node : public ast_node
 {
     virtual int accept(visitor*);
 
-    double_linked_list_node<ast_node*>* expressions {nullptr};
+    small_vector<ast_node*>* expressions {nullptr};
 };
 
 
@@ -89,11 +92,21 @@ struct assignment_node : public ast_node
 {
     virtual int accept(visitor*);
 
-    const char* variable {nullptr}; // variable name
+    int variable {}; // symbol id of the variable name
     ast_node* expression {nullptr}; // RHS
 };
 
 
+struct index_node : public ast_node
+{
+    virtual int accept(visitor*);
+
+    int array {}; // symbol id of the array parameter
+    ast_node* index {nullptr};
+    ast_node* value {nullptr}; // stored value, null for a load
+};
+
+
 struct if_else_node : public ast_node
 {
     virtual int accept(visitor*);
@@ -115,21 +128,25 @@ struct for_loop_node : public ast_node
 };
 
 
-number_node* make_number_node(const char*);
+number_node* make_number_node(const char* lexeme, size_t length, double);
 
-variable_node* make_variable_node(const char*);
+number_node* make_number_node(double); // for values computed from the AST
+
+variable_node* make_variable_node(int);
 
 binary_expression_node* make_binary_expression_node(ast_node*, ast_node*, char);
 
-call_function_node* make_call_function_node(const char*, double_linked_list_node<ast_node*>*);
+call_function_node* make_call_function_node(int, small_vector<ast_node*>*);
 
-function_declaration_node* make_function_declaration_node(const char*, double_linked_list_node<variable_node*>*);
+function_declaration_node* make_function_declaration_node(int, small_vector<variable_node*>*);
 
 function_definition_node* make_function_definition_node(function_declaration_node*, ast_node*);
 
-block_node* make_block_node(double_linked_list_node<ast_node*>*);
+block_node* make_block_node(small_vector<ast_node*>*);
+
+assignment_node* make_assignment_node(int, ast_node*);
 
-assignment_node* make_assignment_node(const char*, ast_node*);
+index_node* make_index_node(int, ast_node*, ast_node*);
 
 if_else_node* make_if_else_node(ast_node*, ast_node*, ast_node*);
 
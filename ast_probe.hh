@@ -0,0 +1,105 @@
+#ifndef KS_AST_PROBE_HH
+#define KS_AST_PROBE_HH
+
+#include <algorithm>
+#include <vector>
+#include "visitor.hh"
+
+
+// The AST has no RTTI; this visitor tells what a node is.
+struct node_probe : public visitor
+{
+    explicit node_probe(ast_node* node) { node->accept(this); }
+
+    virtual int visit(top_level_node*) { return 0; }
+    virtual int visit(number_node* node) { number = node; return 0; }
+    virtual int visit(variable_node* node) { variable = node; return 0; }
+    virtual int visit(binary_expression_node* node) { binary = node; return 0; }
+    virtual int visit(call_function_node* node) { call = node; return 0; }
+    virtual int visit(function_declaration_node*) { return 0; }
+    virtual int visit(function_definition_node*) { return 0; }
+    virtual int visit(block_node*) { return 0; }
+    virtual int visit(assignment_node* node) { assignment = node; return 0; }
+    virtual int visit(index_node*) { return 0; }
+    virtual int visit(if_else_node*) { return 0; }
+    virtual int visit(for_loop_node*) { return 0; }
+
+    number_node* number {nullptr};
+    variable_node* variable {nullptr};
+    binary_expression_node* binary {nullptr};
+    call_function_node* call {nullptr};
+    assignment_node* assignment {nullptr};
+};
+
+// What evaluating a subtree may touch: the variables it reads and assigns,
+// whether it calls functions and whether it reads or writes arrays.
+struct effect_probe : public visitor
+{
+    explicit effect_probe(ast_node* node) { node->accept(this); }
+
+    bool reads(int variable) const { return std::find(read.begin(), read.end(), variable) != read.end(); }
+    bool assigns(int variable) const { return std::find(assigned.begin(), assigned.end(), variable) != assigned.end(); }
+
+    virtual int visit(top_level_node*) { return 0; }
+    virtual int visit(number_node*) { return 0; }
+    virtual int visit(variable_node* node) { read.push_back(node->name); return 0; }
+    virtual int visit(binary_expression_node* node) { node->lhs->accept(this); return node->rhs->accept(this); }
+    virtual int visit(call_function_node* node)
+    {
+        calls = true;
+        for (ast_node* child : *node->arguments) child->accept(this);
+        return 0;
+    }
+    virtual int visit(function_declaration_node*) { return 0; }
+    virtual int visit(function_definition_node*) { return 0; }
+    virtual int visit(block_node* node) { for (ast_node* child : *node->expressions) child->accept(this); return 0; }
+    virtual int visit(assignment_node* node) { assigned.push_back(node->variable); return node->expression->accept(this); }
+    virtual int visit(index_node* node)
+    {
+        (node->value ? stores : loads) = true;
+        node->index->accept(this);
+        return node->value ? node->value->accept(this) : 0;
+    }
+    virtual int visit(if_else_node* node) { node->condition->accept(this); node->then_expr->accept(this); return node->else_expr->accept(this); }
+    virtual int visit(for_loop_node* node) { node->init->accept(this); node->cond->accept(this); node->step->accept(this); return node->expr->accept(this); }
+
+    std::vector<int> read;     // symbol ids, with repeats
+    std::vector<int> assigned; // symbol ids, with repeats
+    bool calls {};
+    bool loads {};
+    bool stores {};
+};
+
+// Whether a subtree is arithmetic on numbers and variables of at most
+// budget nodes: evaluating it cannot fault, have a side effect or loop,
+// and costs little. It stops as soon as the answer is no.
+struct pure_probe : public visitor
+{
+    pure_probe(ast_node* node, int budget) : budget(budget) { pure = node->accept(this) == 0; }
+
+    int count() { return --budget < 0; }
+
+    virtual int visit(top_level_node*) { return 1; }
+    virtual int visit(number_node*) { return count(); }
+    virtual int visit(variable_node*) { return count(); }
+    virtual int visit(binary_expression_node* node) { return count() || node->lhs->accept(this) || node->rhs->accept(this); }
+    virtual int visit(call_function_node*) { return 1; }
+    virtual int visit(function_declaration_node*) { return 1; }
+    virtual int visit(function_definition_node*) { return 1; }
+    virtual int visit(block_node* node)
+    {
+        if (count()) return 1;
+        for (ast_node* child : *node->expressions)
+            if (child->accept(this)) return 1;
+        return 0;
+    }
+    virtual int visit(assignment_node*) { return 1; }
+    virtual int visit(index_node*) { return 1; } // may be out of bounds where the source does not load
+    virtual int visit(if_else_node* node) { return count() || node->condition->accept(this) || node->then_expr->accept(this) || node->else_expr->accept(this); }
+    virtual int visit(for_loop_node*) { return 1; }
+
+    int budget;
+    bool pure {};
+};
+
+#endif // KS_AST_PROBE_HH
@@ -0,0 +1,147 @@
+#include "batch_compiler.hh"
+#include "fold_visitor.hh"
+#include "ast_file.hh"
+#include "work_pool.hh"
+#include "utility.hh"
+#include "trace.hh"
+
+#include <cstdlib>
+#include <algorithm>
+
+#include <sys/stat.h>
+
+
+batch_compiler::batch_compiler(const codegen_options& options, const frontend_options& frontend, int threads)
+{
+    this->options = options;
+    this->options.output.clear(); // every source has its own
+    this->frontend = frontend;
+    if (threads > 0) thread_count = threads;
+}
+
+
+batch_compiler::capture::capture(std::string& text) : text(text)
+{
+    stream = open_memstream(&buffer, &length);
+    set_diagnostic_stream(stream); // stderr if it could not be opened
+}
+
+batch_compiler::capture::~capture()
+{
+    set_diagnostic_stream(nullptr);
+    if (!stream) return;
+    fclose(stream);
+    text.append(buffer, length);
+    free(buffer);
+}
+
+
+int batch_compiler::initialize()
+{
+    sources.clear();
+
+    // Fail early on a bad target rather than in every job.
+    codegen_visitor probe(nullptr, options);
+    return probe.initialize();
+}
+
+
+void batch_compiler::add_source(const char* filename)
+{
+    struct stat status;
+    sources.emplace_back();
+    sources.back().filename = filename;
+    sources.back().size = stat(filename, &status) == 0 ? status.st_size : 0;
+}
+
+
+int batch_compiler::run()
+{
+    // Largest first, ties in the order of the command line: the pool deals
+    // them out in this order.
+    std::vector<int> order;
+    for (size_t i = 0; i < sources.size(); ++i)
+        order.push_back(i);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sources[a].size > sources[b].size; });
+
+    work_pool pool(thread_count);
+    pool.run(order, [&](int i)
+    {
+        source& job = sources[i];
+        trace_scope scope("driver", "source", job.filename.c_str());
+        capture diagnostics(job.diagnostics);
+        job.status = compile(job);
+    });
+
+    int status = 0;
+    for (source& job : sources)
+    {
+        print(job);
+        status |= job.status;
+    }
+    return status;
+}
+
+
+int batch_compiler::compile(source& job)
+{
+    codegen_visitor the_visitor(job.filename.c_str(), options);
+    if (the_visitor.initialize() != 0)
+        return 1;
+
+    compiler_instance instance;
+    fold_visitor the_folder;
+    instance.the_visitor = &the_visitor;
+    if (frontend.fold) instance.the_folder = &the_folder;
+    instance.lexer = frontend.lexer;
+
+    ast_file_reader reader;
+    // Nothing is emitted, printed or written for a source that did not
+    // compile cleanly.
+    if (instance.parse_file(job.filename.c_str(), reader) != 0 || instance.errors != 0)
+        return 1;
+
+    std::string object_code;
+    if (the_visitor.emit(object_code, options.emit_ir ? &job.ir_text : nullptr) != 0)
+        return 1;
+
+    if (options.emit_object && options.stop_after >= phase_emit)
+        return write_output(job, object_code);
+    return 0;
+}
+
+
+int batch_compiler::write_output(source& job, const std::string& object_code)
+{
+    std::string output_filename = job.filename + (options.lto == lto_prelink ? ".bc" : ".o");
+    FILE* fd = fopen(output_filename.c_str(), "wb");
+    if (!fd)
+    {
+        fprintf(diagnostic_stream(), "[ERROR] Cannot open file \"%s\".\n", output_filename.c_str());
+        return 1;
+    }
+    bool written = fwrite(object_code.data(), 1, object_code.size(), fd) == object_code.size();
+    if (fclose(fd) != 0 || !written)
+    {
+        fprintf(diagnostic_stream(), "[ERROR] Cannot write file \"%s\".\n", output_filename.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+
+void batch_compiler::print(source& job)
+{
+    fwrite(job.ir_text.data(), 1, job.ir_text.size(), stdout);
+    fflush(stdout);
+
+    // One line at a time, each naming its source
+    const std::string& text = job.diagnostics;
+    for (size_t start = 0; start < text.size(); )
+    {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) end = text.size();
+        fprintf(stderr, "%s: %.*s\n", job.filename.c_str(), (int)(end - start), text.data() + start);
+        start = end + 1;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef KS_BATCH_COMPILER_HH
+#define KS_BATCH_COMPILER_HH
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "codegen_visitor.hh"
+#include "compiler_instance.hh"
+
+
+// Compiles many sources into one object each (-j N) on a work-stealing pool
+// of threads. A source is a job from start to end: a compiler_instance of
+// its own parses it into a codegen_visitor, which has its own LLVMContext,
+// and the object is written. The diagnostics of a job are collected and
+// printed with its IR in the order of the sources, whichever job finishes
+// first, so the output does not depend on the number of threads.
+class batch_compiler
+{
+public:
+    batch_compiler(const codegen_options&, const frontend_options&, int threads);
+
+    int initialize();
+    void add_source(const char*);
+    int run(); // 1 if some source failed
+
+protected:
+    struct source
+    {
+        std::string filename;
+        size_t size {}; // of the file, the largest are compiled first
+        std::string diagnostics;
+        std::string ir_text;
+        int status {};
+    };
+
+    // What the calling thread reports while it lives goes to text.
+    struct capture
+    {
+        explicit capture(std::string& text);
+        ~capture();
+
+        std::string& text;
+        char* buffer {nullptr};
+        size_t length {};
+        FILE* stream {nullptr};
+    };
+
+    int compile(source&);
+    int write_output(source&, const std::string& object_code);
+    void print(source&);
+
+    codegen_options options;
+    frontend_options frontend;
+    int thread_count {1};
+    std::vector<source> sources;
+};
+
+#endif // KS_BATCH_COMPILER_HH
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Compile-throughput benchmark for kcc.
+
+Every workload from gen_workload.py is compiled with --stop-after at each
+phase: lex, parse, codegen, optimize and emit (the full compile). A phase's
+time is the difference to the run stopping one phase earlier, and the time
+kcc takes to start on an empty file is taken off the lexer's; its peak RSS
+is that of the run ending with it. The best of --repeat runs is kept.
+
+Results are written as JSON; --compare prints the change against an earlier
+results file.
+
+Usage: compile_bench.py [--kcc ./kcc] [--scale N] [--repeat N] [--opt -O2]
+                        [--out results.json] [--compare old.json]
+"""
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gen_workload
+
+
+PHASES = ["lex", "parse", "codegen", "optimize", "emit"]
+
+
+def run_once(kcc, source, phase, opt):
+    """Run kcc once, return (seconds, peak RSS in KiB)."""
+    command = [kcc, opt, "--no-ir", source]
+    if phase != "emit":
+        command.insert(1, "--stop-after=" + phase)
+
+    start = time.perf_counter()
+    process = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.perf_counter() - start
+    errors = process.stderr.read().decode(errors="replace")
+    process.stderr.close()
+
+    if status != 0 or "[ERROR]" in errors:
+        sys.exit("kcc failed on %s (%s):\n%s" % (source, phase, errors))
+    return elapsed, usage.ru_maxrss # KiB on Linux
+
+
+def bench_workload(kcc, source, opt, repeat, startup):
+    with open(source) as f:
+        lines = sum(1 for _ in f)
+
+    results = {}
+    previous = startup
+    for phase in PHASES:
+        runs = [run_once(kcc, source, phase, opt) for _ in range(repeat)]
+        total = min(seconds for seconds, _ in runs)
+        rss = min(kib for _, kib in runs)
+        seconds = max(total - previous, 1e-6) # below the resolution of the measure
+        results[phase] = {
+            "seconds": round(seconds, 6),
+            "cumulative_seconds": round(total, 6),
+            "lines_per_sec": round(lines / seconds, 1),
+            "peak_rss_kib": rss,
+        }
+        previous = max(previous, total)
+
+    return {"lines": lines, "bytes": os.path.getsize(source), "phases": results}
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "--short", "HEAD"], stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def print_table(report, baseline=None):
+    print("%-16s %-9s %10s %14s %12s%s" % ("workload", "phase", "seconds", "lines/sec", "peak RSS", "   vs baseline" if baseline else ""))
+    for name, workload in sorted(report["workloads"].items()):
+        for phase in PHASES:
+            result = workload["phases"][phase]
+            line = "%-16s %-9s %10.4f %14.0f %9d KiB" % (name, phase, result["seconds"], result["lines_per_sec"], result["peak_rss_kib"])
+            old = baseline and baseline["workloads"].get(name, {}).get("phases", {}).get(phase)
+            if old and old["seconds"] > 0 and old["peak_rss_kib"] > 0:
+                line += "   time %+6.1f%%  rss %+6.1f%%" % (
+                    100.0 * (result["seconds"] / old["seconds"] - 1.0),
+                    100.0 * (result["peak_rss_kib"] / old["peak_rss_kib"] - 1.0))
+            print(line)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--kcc", default="./kcc", help="compiler to measure (default ./kcc)")
+    parser.add_argument("--scale", type=int, default=1, help="workload size multiplier (default 1)")
+    parser.add_argument("--repeat", type=int, default=3, help="runs per phase, the fastest counts (default 3)")
+    parser.add_argument("--opt", default="-O2", help="optimization level (default -O2)")
+    parser.add_argument("--work", default="bench/work", help="directory for the generated workloads")
+    parser.add_argument("--out", default="bench/results-compile.json", help="results file")
+    parser.add_argument("--compare", help="earlier results file to compare against")
+    parser.add_argument("workloads", nargs="*", help="workloads to run (default all)")
+    args = parser.parse_args()
+
+    os.makedirs(args.work, exist_ok=True)
+    report = {
+        "benchmark": "compile",
+        "revision": git_revision(),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "kcc": args.kcc,
+        "opt": args.opt,
+        "scale": args.scale,
+        "repeat": args.repeat,
+        "workloads": {},
+    }
+
+    empty = os.path.join(args.work, "empty.kal")
+    open(empty, "w").close()
+    startup = min(run_once(args.kcc, empty, "lex", args.opt)[0] for _ in range(args.repeat))
+    report["startup_seconds"] = round(startup, 6)
+
+    for name in args.workloads or sorted(gen_workload.WORKLOADS):
+        source = gen_workload.generate(name, args.scale, args.work)
+        report["workloads"][name] = bench_workload(args.kcc, source, args.opt, args.repeat, startup)
+
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+    baseline = None
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+    print_table(report, baseline)
+    print("results written to %s" % args.out)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Generate synthetic Kaleidoscope workloads for the compile benchmark.
+
+Each workload stresses one shape of program and grows linearly with --scale:
+
+  many_defs    thousands of small definitions calling each other
+  long_block   one function with a very long block of assignments
+  long_args    definitions and calls with very long argument lists
+  nested_if    deeply nested if/then/else chains
+  long_for     for loops with long bodies
+  mixed        a bit of everything, closest to real programs
+  commented    deeply indented code under long comments, mostly blanks
+
+Usage: gen_workload.py [--scale N] [--out DIR] [workload ...]
+"""
+
+import argparse
+import os
+import random
+
+
+def many_defs(scale):
+    n = 2000 * scale
+    lines = ["# %d small definitions" % n]
+    lines.append("def f0(x) x * 2 + 1;")
+    for i in range(1, n):
+        lines.append("def f%d(x) if x < %d then f%d(x + 1) * 0.5 else x - %d;" % (i, i % 97, i - 1, i % 13))
+    lines.append("f%d(1);" % (n - 1))
+    return lines
+
+
+def long_block(scale):
+    n = 5000 * scale
+    lines = ["# one block of %d assignments" % n, "def block(a, b) {"]
+    lines.append("    v0 = a + b,")
+    for i in range(1, n):
+        lines.append("    v%d = v%d * %d.5 - b / (a + %d)," % (i, i - 1, i % 7, i % 11))
+    lines.append("    v%d" % (n - 1))
+    lines.append("};")
+    lines.append("block(1, 2);")
+    return lines
+
+
+def long_args(scale):
+    n = 200 * scale
+    count = 50
+    args = ", ".join("a%d" % i for i in range(n))
+    body = " + ".join("a%d * %d" % (i, i % 5 + 1) for i in range(n))
+    lines = ["# %d definitions with %d arguments" % (count, n)]
+    for k in range(count):
+        lines.append("def wide%d(%s) %s;" % (k, args, body))
+    values = ", ".join("%d" % (i % 10) for i in range(n))
+    for k in range(count):
+        lines.append("wide%d(%s);" % (k, values))
+    return lines
+
+
+def nested_if(scale):
+    depth = 1000 * scale
+    lines = ["# if/else chain %d deep" % depth, "def pick(x)"]
+    for i in range(depth):
+        lines.append("  if x < %d then %d else" % (i, i * 3))
+    lines.append("  0 - 1;")
+    lines.append("pick(%d);" % (depth // 2))
+    return lines
+
+
+def long_for(scale):
+    n = 100 * scale
+    body = 200
+    lines = ["# %d loops with %d statements each" % (n, body)]
+    for k in range(n):
+        lines.append("def loop%d(n) {" % k)
+        lines.append("    s = 0, t = 1,")
+        lines.append("    for i = 0, i < n, i = i + 1, {")
+        for j in range(body):
+            lines.append("        s = s + i * %d - t / %d," % (j % 9 + 1, j % 5 + 2))
+        lines.append("        t = t + 1")
+        lines.append("    },")
+        lines.append("    s")
+        lines.append("};")
+    lines.append("loop0(10);")
+    return lines
+
+
+def mixed(scale):
+    rng = random.Random(42) # same program on every run
+    n = 1000 * scale
+    lines = ["# %d mixed definitions" % n, "extern sin(x);", "extern cos(x);"]
+    lines.append("def m0(x, y) x + y;")
+    for i in range(1, n):
+        callee = rng.randrange(i)
+        kind = rng.randrange(4)
+        if kind == 0:
+            lines.append("def m%d(x, y) m%d(x * %d, y - 1) + sin(x);" % (i, callee, rng.randrange(1, 9)))
+        elif kind == 1:
+            lines.append("def m%d(x, y) if x < y then m%d(y, x) else cos(y) * x;" % (i, callee))
+        elif kind == 2:
+            lines.append("def m%d(x, y) { a = x * y, b = a + %d, c = b / (a + 1), a + b + c };" % (i, rng.randrange(100)))
+        else:
+            lines.append("def m%d(x, y) { s = 0, for i = 0, i < x, i = i + 1, { s = s + m%d(i, y) }, s };" % (i, callee))
+    lines.append("m%d(3, 4);" % (n - 1))
+    return lines
+
+
+def commented(scale):
+    n = 500 * scale
+    rule = "#" + "-" * 78
+    lines = ["# %d indented definitions with their comments" % n]
+    for k in range(n):
+        lines.append(rule)
+        lines.append("# step%d: scales its argument, %s" % (k, "then adds the previous step " * 2))
+        lines.append(rule)
+        lines.append("def step%d(value_of_x)" % k)
+        lines.append("{")
+        lines.append("        intermediate_value = value_of_x * %d.25,    # the scaled argument" % (k % 8))
+        lines.append("")
+        lines.append("                intermediate_value + %d" % k)
+        lines.append("};")
+        lines.append("")
+    lines.append("step0(1);")
+    return lines
+
+
+WORKLOADS = {
+    "many_defs": many_defs,
+    "long_block": long_block,
+    "long_args": long_args,
+    "nested_if": nested_if,
+    "long_for": long_for,
+    "mixed": mixed,
+    "commented": commented,
+}
+
+
+def generate(name, scale, out_dir):
+    path = os.path.join(out_dir, "%s-x%d.kal" % (name, scale))
+    with open(path, "w") as f:
+        f.write("\n".join(WORKLOADS[name](scale)))
+        f.write("\n")
+    return path
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--scale", type=int, default=1, help="size multiplier (default 1)")
+    parser.add_argument("--out", default="bench/work", help="output directory (default bench/work)")
+    parser.add_argument("workloads", nargs="*", help="workloads to generate (default all)")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    for name in args.workloads or sorted(WORKLOADS):
+        if name not in WORKLOADS:
+            parser.error("unknown workload %s" % name)
+        print(generate(name, args.scale, args.out))
+
+
+if __name__ == "__main__":
+    main()
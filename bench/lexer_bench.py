@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Lexer benchmark for kcc: flex against the SSE2/AVX2 scanner.
+
+Every workload from gen_workload.py is lexed with --stop-after=lex under
+each --lexer. The time kcc takes to start on an empty file is taken off and
+the best of --repeat runs is kept, giving MB/s per lexer and the speedup of
+simd over flex.
+
+Before timing, both lexers must agree on the workload: its AST written with
+--emit-ast, which holds every token the parser kept with its line and
+column, has to be the same bytes, and so do the diagnostics of a parse.
+
+Usage: lexer_bench.py [--kcc ./kcc] [--scale N] [--repeat N]
+                      [--out results.json] [--compare old.json]
+"""
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gen_workload
+
+
+LEXERS = ["flex", "simd"]
+
+
+def run_once(kcc, source, lexer):
+    """Lex a source once, return the seconds taken."""
+    command = [kcc, "--stop-after=lex", "--lexer=" + lexer, source]
+    start = time.perf_counter()
+    result = subprocess.run(command, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    elapsed = time.perf_counter() - start
+    if result.returncode != 0:
+        sys.exit("kcc failed to lex %s with %s:\n%s" % (source, lexer, result.stderr.decode(errors="replace")))
+    return elapsed
+
+
+def check_agreement(kcc, source, work):
+    """Exit unless both lexers give the same AST and diagnostics."""
+    outputs = {}
+    for lexer in LEXERS:
+        ast = os.path.join(work, "%s.%s.kast" % (os.path.basename(source), lexer))
+        result = subprocess.run([kcc, "--lexer=" + lexer, "--emit-ast=" + ast, source],
+                                stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+        with open(ast, "rb") as f:
+            outputs[lexer] = (f.read(), result.stderr)
+        os.remove(ast)
+    if outputs["flex"] != outputs["simd"]:
+        sys.exit("the lexers disagree on %s" % source)
+
+
+def bench_workload(kcc, source, repeat, startup):
+    size = os.path.getsize(source)
+    results = {}
+    for lexer in LEXERS:
+        total = min(run_once(kcc, source, lexer) for _ in range(repeat))
+        seconds = max(total - startup, 1e-6) # below the resolution of the measure
+        results[lexer] = {
+            "seconds": round(seconds, 6),
+            "mb_per_sec": round(size / seconds / 1e6, 2),
+        }
+    return {"bytes": size, "lexers": results,
+            "speedup": round(results["flex"]["seconds"] / results["simd"]["seconds"], 2)}
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "--short", "HEAD"], stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def print_table(report, baseline=None):
+    print("%-16s %10s %12s %12s %9s%s" % ("workload", "bytes", "flex MB/s", "simd MB/s", "speedup", "   vs baseline" if baseline else ""))
+    for name, workload in sorted(report["workloads"].items()):
+        line = "%-16s %10d %12.1f %12.1f %8.2fx" % (name, workload["bytes"], workload["lexers"]["flex"]["mb_per_sec"],
+                                                   workload["lexers"]["simd"]["mb_per_sec"], workload["speedup"])
+        old = baseline and baseline["workloads"].get(name)
+        if old:
+            line += "   simd time %+6.1f%%" % (
+                100.0 * (workload["lexers"]["simd"]["seconds"] / old["lexers"]["simd"]["seconds"] - 1.0))
+        print(line)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--kcc", default="./kcc", help="compiler to measure (default ./kcc)")
+    parser.add_argument("--scale", type=int, default=8, help="workload size multiplier (default 8)")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per lexer, the fastest counts (default 5)")
+    parser.add_argument("--work", default="bench/work", help="directory for the generated workloads")
+    parser.add_argument("--out", default="bench/results-lexer.json", help="results file")
+    parser.add_argument("--compare", help="earlier results file to compare against")
+    parser.add_argument("workloads", nargs="*", help="workloads to run (default all)")
+    args = parser.parse_args()
+
+    os.makedirs(args.work, exist_ok=True)
+    report = {
+        "benchmark": "lexer",
+        "revision": git_revision(),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "kcc": args.kcc,
+        "scale": args.scale,
+        "repeat": args.repeat,
+        "workloads": {},
+    }
+
+    empty = os.path.join(args.work, "empty.kal")
+    open(empty, "w").close()
+    startup = min(run_once(args.kcc, empty, "flex") for _ in range(args.repeat))
+    report["startup_seconds"] = round(startup, 6)
+
+    for name in args.workloads or sorted(gen_workload.WORKLOADS):
+        source = gen_workload.generate(name, args.scale, args.work)
+        check_agreement(args.kcc, source, args.work)
+        report["workloads"][name] = bench_workload(args.kcc, source, args.repeat, startup)
+
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+    baseline = None
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+    print_table(report, baseline)
+    print("results written to %s" % args.out)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+/* Times every kernel of kernels.kal against its C twin.
+ *
+ * Usage: harness [samples] [milliseconds per sample]
+ *
+ * Prints one JSON object per line and implementation:
+ * {"kernel": ..., "impl": "kal"|"c", "ns_per_call": mean, "stddev": ...,
+ *  "samples": ..., "calls_per_sample": ..., "result": ...}
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+double fib_1(double);
+double fib_2(double);
+double sum(double);
+double nested_loop(double);
+double poly_loop(double);
+double axpy(double*, double*, double, double);
+double dot(double*, double*, double);
+
+double c_fib_1(double);
+double c_fib_2(double);
+double c_sum(double);
+double c_nested_loop(double);
+double c_poly_loop(double);
+double c_axpy(double*, const double*, double, double);
+double c_dot(const double*, const double*, double);
+
+typedef double (*kernel_fn)(double);
+
+/* The array kernels run on static arrays of array_size elements, each
+ * implementation on its own output. */
+enum { array_size = 1000 };
+static double xs[array_size], ws[array_size], ys_kal[array_size], ys_c[array_size];
+
+static double axpy_kal(double n) { return axpy(ys_kal, xs, 0.5, n); }
+static double axpy_c(double n) { return c_axpy(ys_c, xs, 0.5, n); }
+static double dot_kal(double n) { return dot(xs, ws, n); }
+static double dot_c(double n) { return c_dot(xs, ws, n); }
+
+struct kernel
+{
+    const char* name;
+    kernel_fn kal;
+    kernel_fn c;
+    double argument;
+};
+
+static const struct kernel kernels[] = {
+    { "fib_1",       fib_1,       c_fib_1,       20 },
+    { "fib_2",       fib_2,       c_fib_2,       90 },
+    { "sum",         sum,         c_sum,         1000 },
+    { "nested_loop", nested_loop, c_nested_loop, 1000 },
+    { "poly_loop",   poly_loop,   c_poly_loop,   1000 },
+    { "axpy",        axpy_kal,    axpy_c,        array_size },
+    { "dot",         dot_kal,     dot_c,         array_size },
+};
+
+static volatile double sink; /* keeps the calls from being optimized out */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double time_calls(kernel_fn fn, double argument, long calls)
+{
+    double start = now_ns();
+    for (long i = 0; i < calls; ++i)
+        sink = fn(argument);
+    return now_ns() - start;
+}
+
+static void bench(const char* name, const char* impl, kernel_fn fn, double argument, int samples, double sample_ns)
+{
+    /* Grow the number of calls until a sample lasts long enough. */
+    long calls = 1;
+    while (time_calls(fn, argument, calls) < sample_ns / 10 && calls < (1L << 40))
+        calls *= 2;
+    calls = (long)(calls * 10.0);
+
+    double total = 0, total_sq = 0;
+    for (int s = 0; s < samples; ++s)
+    {
+        double per_call = time_calls(fn, argument, calls) / calls;
+        total += per_call;
+        total_sq += per_call * per_call;
+    }
+
+    double mean = total / samples;
+    double variance = samples > 1 ? (total_sq - samples * mean * mean) / (samples - 1) : 0;
+    printf("{\"kernel\": \"%s\", \"impl\": \"%s\", \"ns_per_call\": %.3f, \"stddev\": %.3f, "
+           "\"samples\": %d, \"calls_per_sample\": %ld, \"result\": %.17g}\n",
+        name, impl, mean, sqrt(variance > 0 ? variance : 0), samples, calls, fn(argument));
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    int samples = argc > 1 ? atoi(argv[1]) : 20;
+    double sample_ms = argc > 2 ? atof(argv[2]) : 20;
+    if (samples < 1) samples = 1;
+
+    for (int i = 0; i < array_size; ++i)
+    {
+        xs[i] = (double)i / array_size;
+        ws[i] = 1 - xs[i];
+    }
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+    {
+        const struct kernel* k = &kernels[i];
+        if (k->kal(k->argument) != k->c(k->argument))
+            fprintf(stderr, "[WARNING] %s: kal and C results differ (%.17g vs %.17g)\n",
+                k->name, k->kal(k->argument), k->c(k->argument));
+        bench(k->name, "kal", k->kal, k->argument, samples, sample_ms * 1e6);
+        bench(k->name, "c", k->c, k->argument, samples, sample_ms * 1e6);
+    }
+    return 0;
+}
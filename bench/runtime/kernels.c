@@ -0,0 +1,73 @@
+/* C versions of the kernels in kernels.kal, written the way the .kal code
+ * computes them (all doubles, comparisons as 0/1). */
+
+double c_fib_1(double x)
+{
+    if (x < 3)
+        return 1;
+    return c_fib_1(x - 1) + c_fib_1(x - 2);
+}
+
+double c_fib_2(double x)
+{
+    double a = 1, b = 1, c = 1;
+    for (double i = 2; i < x; i = i + 1)
+    {
+        c = a + b;
+        a = b;
+        b = c;
+    }
+    return c;
+}
+
+double c_sum(double n)
+{
+    double s = 0;
+    for (double i = 0; i < n; i = i + 1)
+        s = s + i;
+    return s;
+}
+
+static double c_nested(double x)
+{
+    if (x > 0)
+        return x > 1 ? x * 2 : x + 1;
+    return x > 0 - 1 ? x - 1 : x * x;
+}
+
+double c_nested_loop(double n)
+{
+    double s = 0;
+    for (double i = 0; i < n; i = i + 1)
+        s = s + c_nested(i / n * 4 - 2);
+    return s;
+}
+
+static double c_poly(double x)
+{
+    return (((x * 0.5 + 1.5) * x - 2) * x + 0.25) * x + 3;
+}
+
+double c_poly_loop(double n)
+{
+    double s = 0;
+    for (double i = 0; i < n; i = i + 1)
+        s = s + c_poly(i / n);
+    return s;
+}
+
+double c_axpy(double* restrict y, const double* restrict x, double a, double n)
+{
+    double r = 0;
+    for (double i = 0; i < n; i = i + 1)
+        r = y[(long)i] = a * x[(long)i] + y[(long)i];
+    return r;
+}
+
+double c_dot(const double* restrict x, const double* restrict y, double n)
+{
+    double s = 0;
+    for (double i = 0; i < n; i = i + 1)
+        s = s + x[(long)i] * y[(long)i];
+    return s;
+}
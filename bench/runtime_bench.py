@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Runtime benchmark of the code kcc generates, against C baselines.
+
+bench/runtime/kernels.kal is compiled by kcc under every configuration in
+CONFIGS, its C twin bench/runtime/kernels.c once by the C compiler, and both
+are linked with bench/runtime/harness.c, which times every kernel and
+reports ns/call with its standard deviation over the samples.
+
+Results are written as JSON; the table shows each kal kernel against C.
+
+Usage: runtime_bench.py [--kcc ./kcc] [--cc clang] [--cflags "-O2"]
+                        [--samples N] [--sample-ms MS] [--out results.json]
+"""
+
+import argparse
+import json
+import os
+import platform
+import shlex
+import shutil
+import subprocess
+import sys
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+RUNTIME = os.path.join(HERE, "runtime")
+
+# Every optimization configuration kcc supports
+CONFIGS = [
+    ("O0", ["-O0"]),
+    ("O1", ["-O1"]),
+    ("O2", ["-O2"]),
+    ("O3", ["-O3"]),
+    ("O3-native", ["-O3", "-march=native"]),
+    ("O3-native-fma", ["-O3", "-march=native", "-ffp-contract=fast"]),
+]
+
+
+def run(command, **kwargs):
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, **kwargs)
+    errors = result.stderr.decode(errors="replace")
+    if result.returncode != 0 or "[ERROR]" in errors:
+        sys.exit("failed: %s\n%s" % (" ".join(command), errors))
+    if errors:
+        sys.stderr.write(errors)
+    return result.stdout.decode()
+
+
+def default_cc():
+    return os.environ.get("CC") or shutil.which("clang") or "cc"
+
+
+def build_baseline(cc, cflags, work):
+    objects = []
+    for name in ["kernels.c", "harness.c"]:
+        output = os.path.join(work, name + ".o")
+        run([cc] + cflags + ["-c", os.path.join(RUNTIME, name), "-o", output])
+        objects.append(output)
+    return objects
+
+
+def build_config(kcc, cc, flags, work, baseline):
+    os.makedirs(work, exist_ok=True)
+    source = os.path.join(work, "kernels.kal")
+    shutil.copyfile(os.path.join(RUNTIME, "kernels.kal"), source)
+    run([kcc] + flags + ["--no-ir", source]) # writes kernels.kal.o next to it
+    binary = os.path.join(work, "harness")
+    run([cc, "-o", binary, source + ".o"] + baseline + ["-lm"])
+    return binary
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--kcc", default="./kcc", help="compiler to measure (default ./kcc)")
+    parser.add_argument("--cc", default=default_cc(), help="C compiler of the baselines (default $CC, clang or cc)")
+    parser.add_argument("--cflags", default="-O2", help="flags of the C baselines (default -O2)")
+    parser.add_argument("--samples", type=int, default=20, help="samples per kernel (default 20)")
+    parser.add_argument("--sample-ms", type=float, default=20, help="length of a sample (default 20 ms)")
+    parser.add_argument("--work", default="bench/work/runtime", help="build directory")
+    parser.add_argument("--out", default="bench/results-runtime.json", help="results file")
+    parser.add_argument("configs", nargs="*", help="kcc configurations to run (default all)")
+    args = parser.parse_args()
+
+    configs = [c for c in CONFIGS if not args.configs or c[0] in args.configs]
+    kcc = os.path.abspath(args.kcc)
+    cflags = shlex.split(args.cflags)
+
+    os.makedirs(args.work, exist_ok=True)
+    baseline = build_baseline(args.cc, cflags, args.work)
+
+    report = {
+        "benchmark": "runtime",
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "kcc": args.kcc,
+        "cc": args.cc,
+        "cflags": args.cflags,
+        "samples": args.samples,
+        "sample_ms": args.sample_ms,
+        "configs": {},
+    }
+
+    for name, flags in configs:
+        binary = build_config(kcc, args.cc, flags, os.path.join(args.work, name), baseline)
+        output = run([binary, str(args.samples), str(args.sample_ms)])
+        results = {}
+        for line in output.splitlines():
+            record = json.loads(line)
+            results.setdefault(record.pop("kernel"), {})[record.pop("impl")] = record
+        report["configs"][name] = {"flags": flags, "kernels": results}
+
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+    print("%-14s %-14s %16s %16s %8s" % ("kernel", "kcc", "kal ns/call", "C ns/call", "kal/C"))
+    for name, _ in configs:
+        for kernel, impls in sorted(report["configs"][name]["kernels"].items()):
+            kal, c = impls["kal"], impls["c"]
+            print("%-14s %-14s %9.1f ± %-5.1f %9.1f ± %-5.1f %7.2fx" % (
+                kernel, name, kal["ns_per_call"], kal["stddev"], c["ns_per_call"], c["stddev"],
+                kal["ns_per_call"] / c["ns_per_call"] if c["ns_per_call"] > 0 else float("nan")))
+    print("results written to %s" % args.out)
+
+
+if __name__ == "__main__":
+    main()
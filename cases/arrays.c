@@ -0,0 +1,14 @@
+#include <stdio.h>
+
+double sum(double*, double);
+double axpy(double*, double*, double, double);
+double twice(double*, double);
+double at(double*, double);
+
+int main()
+{
+    double x[5] = {1, 2, 3, 4, 5};
+    double y[5] = {1, 1, 1, 1, 1};
+    axpy(y, x, 2, 5);
+    printf("%lf %lf %lf %lf\n", sum(y, 5), twice(x, 5), y[4], at(x, 1.7));
+}
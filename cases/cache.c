@@ -0,0 +1,8 @@
+#include <stdio.h>
+
+double both(double);
+
+int main()
+{
+    printf("%lf\n", both(1));
+}
@@ -0,0 +1,8 @@
+#include <stdio.h>
+
+double apply(double);
+
+int main()
+{
+    printf("%lf\n", apply(2));
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Regression cases. Every cases/<name>.kal with a <name>.out next to it is
+# run through the commands of its "# RUN:" lines, from the cases directory,
+# and what they print (stdout, then stderr, and "exit <n>" after a command
+# that fails) must be the content of <name>.out. In the commands %kcc is the
+# compiler, %s the case and %t a prefix for temporary files.
+#
+# usage: sh cases/run.sh [path/to/kcc]
+
+kcc=${1:-./kcc}
+kcc=$(cd "$(dirname "$kcc")" && pwd)/$(basename "$kcc")
+cd "$(dirname "$0")" || exit 1
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+count=0
+failed=0
+for expected in *.out; do
+    name=${expected%.out}
+    actual=$work/$name.actual
+    : > "$actual"
+    grep '^# RUN: ' "$name.kal" | sed 's/^# RUN: //' > "$work/$name.run"
+    while IFS= read -r command; do
+        command=$(printf '%s\n' "$command" | sed -e "s|%kcc|$kcc|g" -e "s|%s|$name.kal|g" -e "s|%t|$work/$name|g")
+        sh -c "$command" > "$work/stdout" 2> "$work/stderr" < /dev/null
+        status=$?
+        cat "$work/stdout" "$work/stderr" >> "$actual"
+        [ $status -eq 0 ] || echo "exit $status" >> "$actual"
+    done < "$work/$name.run"
+
+    count=$((count + 1))
+    if cmp -s "$expected" "$actual"; then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        diff -u "$expected" "$actual"
+        failed=$((failed + 1))
+    fi
+done
+
+echo "$((count - failed)) of $count cases passed"
+[ $failed -eq 0 ]
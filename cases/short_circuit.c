@@ -0,0 +1,28 @@
+#include <stdio.h>
+
+double putchard(double c)
+{
+    putchar((int)c);
+    return 0;
+}
+
+double either(double);
+double both(double);
+double pick(double);
+double guard(double*, double, double);
+double clamp(double);
+double inside(double);
+double nested(double);
+
+int main()
+{
+    double a[2] = {1, -1};
+    printf("[%g", either(1));
+    printf(" %g", either(0));
+    printf(" %g", both(0));
+    printf(" %g", both(2));
+    printf(" %g", pick(0));
+    printf(" %g %g %g", guard(a, 0, 2), guard(a, 1, 2), guard(a, 5, 2));
+    printf(" %g %g %g %g", clamp(4), clamp(0.5), inside(0.5), inside(2));
+    printf(" %g %g %g %g]\n", nested(3), nested(0.5), nested(-0.5), nested(-3));
+}
@@ -0,0 +1,9 @@
+#include <stdio.h>
+
+double f1(double);
+double chain(double);
+
+int main()
+{
+    printf("%lf %lf\n", f1(1), chain(0.5));
+}
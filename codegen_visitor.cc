@@ -1,52 +1,264 @@
 #include "codegen_visitor.hh"
+#include "ast_probe.hh"
+#include "symbol_table.hh"
+#include "utility.hh"
+#include "trace.hh"
 
 #include <vector>
 #include <memory>
+#include <cstring>
 #include <iostream>
-#include <unordered_map>
-
+#include <algorithm>
+#include <mutex>
+#include <cmath>
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/ValueHandle.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/DIBuilder.h>
-#include <llvm/Transforms/Utils.h>
-#include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/Scalar/GVN.h>
-#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/DiagnosticPrinter.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Transforms/Scalar/TailRecursionElimination.h>
+#if LLVM_VERSION_MAJOR >= 14
+#include <llvm/MC/TargetRegistry.h>
+#else
 #include <llvm/Support/TargetRegistry.h> // llvm-10
+#endif
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/MCSubtargetInfo.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 
-#define OUTPUT_IR
-#define FUNCTION_OPT
-#define GENERATE_OBJECT
-#define DEBUG_INFO
+using namespace llvm;
 
-#ifdef DEBUG_INFO
-#undef FUNCTION_OPT
-#undef GENERATE_OBJECT
+// LLVM 14 moved the optimization levels out of PassBuilder.
+#if LLVM_VERSION_MAJOR >= 14
+typedef llvm::OptimizationLevel optimization_level;
+#else
+typedef PassBuilder::OptimizationLevel optimization_level;
 #endif
 
-using namespace llvm;
-
 
 // Generate target's object code
-static int generate_target_code(Module& module, std::string& output_filename);
+static int generate_target_code(Module& module, TargetMachine& target_machine, std::string& output_filename);
+static int generate_target_code(Module& module, TargetMachine& target_machine, raw_pwrite_stream& dest);
+
+// Prefix of the names given to anonymous expressions in JIT mode
+static const char* anonymous_prefix = "__anon_expr.";
+
+// In JIT mode the body of a function f is compiled as "f.<version>", and
+// f itself is a stub jumping to the latest version.
+static int body_symbol(StringRef body_name)
+{
+    size_t dot = body_name.rfind('.');
+    if (dot == StringRef::npos) return -1;
+    return find_symbol(body_name.data(), dot);
+}
+
+// Record every pass run by the new pass manager as a trace event, with the
+// function it ran on. Pass managers and adaptors nest, hence the stack.
+static void register_trace_callbacks(PassInstrumentationCallbacks& callbacks, std::vector<uint64_t>& starts)
+{
+    auto before = [&starts](StringRef, Any)
+    {
+        starts.push_back(trace_now());
+    };
+    auto after = [&starts](StringRef pass, Any ir)
+    {
+        std::string name = pass.str();
+        std::string detail;
+        if (any_isa<const Function*>(ir))
+            detail = any_cast<const Function*>(ir)->getName().str();
+        trace_event("optimize", name.c_str(), detail.empty() ? nullptr : detail.c_str(), starts.back(), trace_now());
+        starts.pop_back();
+    };
+
+#if LLVM_VERSION_MAJOR < 12
+    callbacks.registerBeforePassCallback([before](StringRef pass, Any ir) { before(pass, ir); return true; });
+    callbacks.registerAfterPassCallback(after);
+    callbacks.registerAfterPassInvalidatedCallback([after](StringRef pass) { after(pass, Any()); });
+#else
+    callbacks.registerBeforeNonSkippedPassCallback(before);
+    callbacks.registerAfterPassCallback([after](StringRef pass, Any ir, const PreservedAnalyses&) { after(pass, ir); });
+    callbacks.registerAfterPassInvalidatedCallback([after](StringRef pass, const PreservedAnalyses&) { after(pass, Any()); });
+#endif
+}
+
+// A loop "for v = start, v < bound, v = v + step, body" (or counting down
+// with >) whose counter takes integer values only: it can count with an
+// integer, which gives LLVM's loop passes a trip count.
+struct counted_loop
+{
+    int variable {};
+    int64_t start {};
+    int64_t step {};
+    bool upward {};            // v < bound, otherwise v > bound
+    ast_node* bound {nullptr}; // the same on every iteration, evaluated once
+};
+
+// Beyond 2^53 a double no longer holds every integer.
+static const double exact_integer_limit = 9007199254740992.0;
+
+static bool is_integer(ast_node* node, int64_t& value)
+{
+    node_probe probe(node);
+    if (!probe.number) return false;
+    double number = probe.number->number;
+    if (!(std::fabs(number) <= exact_integer_limit) || number != std::floor(number)) return false;
+    value = (int64_t)number;
+    return true;
+}
+
+static bool is_variable(ast_node* node, int variable)
+{
+    node_probe probe(node);
+    return probe.variable && probe.variable->name == variable;
+}
+
+static bool match_counted_loop(for_loop_node* node, counted_loop& loop)
+{
+    node_probe init(node->init);
+    if (!init.assignment || !is_integer(init.assignment->expression, loop.start))
+        return false;
+    loop.variable = init.assignment->variable;
+
+    // v = v + k, v = k + v or v = v - k
+    node_probe step(node->step);
+    if (!step.assignment || step.assignment->variable != loop.variable)
+        return false;
+    node_probe increment(step.assignment->expression);
+    if (!increment.binary)
+        return false;
+    binary_expression_node* add = increment.binary;
+    if (add->operation == '+' && is_variable(add->lhs, loop.variable) && is_integer(add->rhs, loop.step)) {}
+    else if (add->operation == '+' && is_variable(add->rhs, loop.variable) && is_integer(add->lhs, loop.step)) {}
+    else if (add->operation == '-' && is_variable(add->lhs, loop.variable) && is_integer(add->rhs, loop.step)) loop.step = -loop.step;
+    else return false;
+
+    // v < bound, bound > v, v > bound or bound < v
+    node_probe cond(node->cond);
+    if (!cond.binary || (cond.binary->operation != '<' && cond.binary->operation != '>'))
+        return false;
+    bool less = cond.binary->operation == '<';
+    if (is_variable(cond.binary->lhs, loop.variable)) { loop.bound = cond.binary->rhs; loop.upward = less; }
+    else if (is_variable(cond.binary->rhs, loop.variable)) { loop.bound = cond.binary->lhs; loop.upward = !less; }
+    else return false;
+
+    // The counter moves towards the bound, so it never overflows.
+    if (loop.step == 0 || (loop.step > 0) != loop.upward)
+        return false;
+
+    // Only the step changes the counter, and nothing in the loop changes
+    // the bound: it reads no array and calls nothing, whose results or
+    // side effects could differ between iterations.
+    effect_probe bound(loop.bound);
+    if (bound.calls || bound.loads || !bound.assigned.empty() || bound.reads(loop.variable))
+        return false;
+    effect_probe body(node->expr);
+    if (body.assigns(loop.variable))
+        return false;
+    for (int variable : bound.read)
+        if (body.assigns(variable))
+            return false;
+
+    return true;
+}
+
+// Most nodes an operand of & or | or a branch of an if/else may have to be
+// evaluated unconditionally, without a branch
+static const int speculation_budget = 8;
+
+// Report what the linker finds, e.g. a function defined twice, instead of
+// the default handler exiting on the first error
+static void report_link_diagnostic(const DiagnosticInfo& info, void*)
+{
+    if (info.getSeverity() != DS_Error && info.getSeverity() != DS_Warning)
+        return; // remarks of the passes that run later
+
+    std::string message;
+    raw_string_ostream stream(message);
+    DiagnosticPrinterRawOStream printer(stream);
+    info.print(printer);
+    stream.flush();
+    fprintf(diagnostic_stream(), "[%s] %s\n", info.getSeverity() == DS_Error ? "ERROR" : "WARNING", message.c_str());
+}
+
+static void report_call_through_error()
+{
+    fprintf(diagnostic_stream(), "[ERROR] Cannot compile the function called.\n");
+    abort();
+}
+
+
+// Dense table indexed by symbol id. It remembers which entries were set
+// so that clearing it costs no more than filling it did.
+template <class T>
+struct symbol_map
+{
+    T get(int id) const
+    {
+        return (size_t)id < values.size() ? values[id] : nullptr;
+    }
+
+    void set(int id, T value)
+    {
+        if ((size_t)id >= values.size())
+            values.resize(std::max(symbol_count(), (size_t)id + 1), nullptr);
+        if (!values[id]) touched.push_back(id);
+        values[id] = value;
+    }
+
+    void clear()
+    {
+        for (int id : touched) values[id] = nullptr;
+        touched.clear();
+    }
+
+    std::vector<T> values;
+    std::vector<int> touched;
+};
 
 
 struct codegen_visitor::codegen_impl
 {
     codegen_impl() :
-    context(),
-    builder(context),
-    module("kaleidoscope", context),
-    debugger(module),
-    FPM(&module)
+    ts_context(std::make_unique<LLVMContext>()),
+    context(*ts_context.getContext()),
+    builder(context)
     {}
 
+    // Prototype of a declared function, kept so that it can be
+    // re-declared in every new module handed to the JIT.
+    struct function_proto
+    {
+        std::vector<int> arguments; // symbol ids
+        std::vector<bool> arrays;   // which arguments are arrays
+        bool declared {};
+        bool defined {};
+        int version {}; // of the body in JIT mode
+    };
+
     void push_value(Value* value)
     {
         value_stack.push_back(value);
@@ -59,30 +271,98 @@ struct codegen_visitor::codegen_impl
         return value;
     }
 
+    // Pop an operand of arithmetic, a branch or a return
+    Value* pop_number()
+    {
+        Value* value = pop_value();
+        if (value && !value->getType()->isDoubleTy())
+        {
+            fprintf(diagnostic_stream(), "[ERROR] An array is used as a number.\n");
+            return nullptr;
+        }
+        return value;
+    }
+
     void set_debug_location_info(ast_node*);
     void unset_debug_location_info();
+    void branch_or_return(BasicBlock*, Value*);
+
+    // Variables of the current function
+    Value* use_variable(int);
+    void define_variable(int, Value*);
+    void seal_block(BasicBlock*);
+    void clear_variables();
+    Value* read_variable(int, BasicBlock*);
+    Value* read_variable_recursive(int, BasicBlock*);
+    Value* add_phi_operands(int, PHINode*);
+    Value* try_remove_trivial_phi(PHINode*);
+
+    int create_target_machine();
+    void create_module();
+    void internalize();
+    void optimize_module();
+    function_proto& get_proto(int);
+    void record_proto(function_declaration_node*);
+    Function* get_function(int);
+    Value* integer_index(ast_node*);
+    Function* create_function(const std::string&, const std::vector<int>&, const std::vector<bool>&);
+    int initialize_jit();
+    int execute(Function*);
+    int redirect(int name, const std::string& body);
 
     // llvm base
-    LLVMContext context;
+    orc::ThreadSafeContext ts_context;
+    LLVMContext& context;
     IRBuilder<> builder;
-    Module module;
+    std::unique_ptr<Module> module;
+    std::string source_filename;
+    codegen_options options;
 
-    // llvm optimization
-    legacy::FunctionPassManager FPM;
+    // target the code is optimized for and emitted to
+    std::unique_ptr<TargetMachine> target_machine;
 
     // DWARF debug info
-    DIBuilder debugger;
+    std::unique_ptr<DIBuilder> debugger;
     DIScope* current_scope {};
     DICompileUnit* compile_unit {};
     DIType* dbltype {};
 
+    // JIT execution (interactive mode and --run)
+    std::unique_ptr<orc::LLJIT> jit;
+    std::unique_ptr<orc::IndirectStubsManager> stubs; // one per named function
+    std::unique_ptr<orc::LazyCallThroughManager> call_through; // compiles the first version on its first call
+    int anonymous_count {};
+
     // customized info
     std::vector<Value*> value_stack;
-    std::unordered_map<std::string, AllocaInst*> value_table;
+    symbol_map<Type*> variable_types; // variables of the current function defined so far
+    symbol_map<Value*> counter_table; // integer counters of the enclosing counted loops
+
+    // Without debug info the variables are SSA values from the start, with
+    // phis placed on the fly (Braun et al., "Simple and Efficient
+    // Construction of Static Single Assignment Form"). A block is sealed
+    // once all its predecessors are known; a variable read before that
+    // gets a phi completed at sealing. With debug info each variable lives
+    // in an alloca that dbg.declare can describe.
+    DenseMap<std::pair<int, BasicBlock*>, WeakTrackingVH> current_def;
+    DenseMap<BasicBlock*, SmallVector<std::pair<int, PHINode*>, 4>> incomplete_phis;
+    SmallPtrSet<BasicBlock*, 16> sealed_blocks;
+    SmallPtrSet<PHINode*, 16> variable_phis;
+    symbol_map<AllocaInst*> value_table; // with debug info
+
+    // Tail position: the node whose value the function returns, set by its
+    // parent just before visiting it. A node there that emits the return
+    // itself sets returned so that its parent does not.
+    int current_name {};
+    ast_node* tail_node {nullptr};
+    bool returned {};
+    symbol_map<Function*> function_table; // functions of the current module
+    std::vector<function_proto> function_protos; // by symbol id
 };
 
 void codegen_visitor::codegen_impl::set_debug_location_info(ast_node* node)
 {
+    if (!options.debug_info) return;
     DIScope* scope = compile_unit;
     if (current_scope) scope = current_scope;
     builder.SetCurrentDebugLocation(DILocation::get(scope->getContext(), node->row, node->col, scope));
@@ -93,41 +373,589 @@ void codegen_visitor::codegen_impl::unset_debug_location_info()
     builder.SetCurrentDebugLocation(DebugLoc());
 }
 
+// End a branch of an if/else: jump to the merge block, or without one
+// return the value unless a tail call did already.
+void codegen_visitor::codegen_impl::branch_or_return(BasicBlock* merge_block, Value* value)
+{
+    if (merge_block)
+        builder.CreateBr(merge_block);
+    else if (!returned)
+        builder.CreateRet(value);
+    returned = false;
+}
+
+// Value of a variable at the insertion point, nullptr if it is unknown
+Value* codegen_visitor::codegen_impl::use_variable(int variable)
+{
+    Type* type = variable_types.get(variable);
+    if (!type) return nullptr;
+
+    if (options.debug_info)
+        return builder.CreateLoad(type, value_table.get(variable));
+    return read_variable(variable, builder.GetInsertBlock());
+}
+
+void codegen_visitor::codegen_impl::define_variable(int variable, Value* value)
+{
+    variable_types.set(variable, value->getType());
+
+    if (!options.debug_info)
+    {
+        current_def[{variable, builder.GetInsertBlock()}] = value;
+        return;
+    }
+
+    AllocaInst* address = value_table.get(variable);
+    if (!address)
+    {
+        // Allocate variables at the top of the entry block (which may still be empty).
+        BasicBlock& entry_block = builder.GetInsertBlock()->getParent()->getEntryBlock();
+        IRBuilder<> entry_builder(&entry_block, entry_block.begin());
+        address = entry_builder.CreateAlloca(value->getType(), nullptr, symbol_name(variable));
+        value_table.set(variable, address);
+    }
+    builder.CreateStore(value, address);
+}
+
+void codegen_visitor::codegen_impl::seal_block(BasicBlock* block)
+{
+    if (options.debug_info) return;
+
+    // Sealed first: completing a phi may read other variables in the block.
+    sealed_blocks.insert(block);
+    auto found = incomplete_phis.find(block);
+    if (found == incomplete_phis.end()) return;
+    SmallVector<std::pair<int, PHINode*>, 4> phis = std::move(found->second);
+    incomplete_phis.erase(found);
+    for (auto& phi : phis)
+        add_phi_operands(phi.first, phi.second);
+}
+
+void codegen_visitor::codegen_impl::clear_variables()
+{
+    variable_types.clear();
+    counter_table.clear();
+    current_def.clear();
+    incomplete_phis.clear();
+    sealed_blocks.clear();
+    variable_phis.clear();
+    value_table.clear();
+}
+
+Value* codegen_visitor::codegen_impl::read_variable(int variable, BasicBlock* block)
+{
+    auto found = current_def.find({variable, block});
+    if (found != current_def.end() && found->second)
+        return found->second;
+    return read_variable_recursive(variable, block);
+}
+
+Value* codegen_visitor::codegen_impl::read_variable_recursive(int variable, BasicBlock* block)
+{
+    Type* type = variable_types.get(variable);
+    Value* value {nullptr};
+
+    if (!sealed_blocks.count(block))
+    {
+        IRBuilder<> phi_builder(block, block->getFirstInsertionPt());
+        PHINode* phi = phi_builder.CreatePHI(type, 2, symbol_name(variable));
+        variable_phis.insert(phi);
+        incomplete_phis[block].push_back({variable, phi});
+        value = phi;
+    }
+    else if (BasicBlock* predecessor = block->getSinglePredecessor())
+    {
+        value = read_variable(variable, predecessor);
+    }
+    else if (pred_empty(block))
+    {
+        value = UndefValue::get(type); // not assigned on this path
+    }
+    else
+    {
+        // Recorded before the operands are read to break cycles
+        IRBuilder<> phi_builder(block, block->getFirstInsertionPt());
+        PHINode* phi = phi_builder.CreatePHI(type, 2, symbol_name(variable));
+        variable_phis.insert(phi);
+        current_def[{variable, block}] = phi;
+        value = add_phi_operands(variable, phi);
+    }
+
+    current_def[{variable, block}] = value;
+    return value;
+}
+
+Value* codegen_visitor::codegen_impl::add_phi_operands(int variable, PHINode* phi)
+{
+    BasicBlock* block = phi->getParent();
+    for (BasicBlock* predecessor : predecessors(block))
+        phi->addIncoming(read_variable(variable, predecessor), predecessor);
+    return try_remove_trivial_phi(phi);
+}
+
+// A phi whose operands are all one value, or itself, is that value. Its
+// removal may make the phis using it trivial in turn.
+Value* codegen_visitor::codegen_impl::try_remove_trivial_phi(PHINode* phi)
+{
+    Value* same {nullptr};
+    for (Value* operand : phi->incoming_values())
+    {
+        if (operand == same || operand == phi)
+            continue;
+        if (same)
+            return phi;
+        same = operand;
+    }
+    if (!same)
+        same = UndefValue::get(phi->getType()); // unreachable or in the entry block
+
+    SmallVector<WeakVH, 8> users;
+    for (User* user : phi->users())
+        if (user != phi && isa<PHINode>(user) && variable_phis.count(cast<PHINode>(user)))
+            users.push_back(user);
+
+    WeakTrackingVH result = same; // follows the replacements below
+    phi->replaceAllUsesWith(same);
+    variable_phis.erase(phi);
+    phi->eraseFromParent();
+
+    for (WeakVH& user : users)
+        if (user)
+            try_remove_trivial_phi(cast<PHINode>(user));
+
+    return result;
+}
+
+int codegen_visitor::codegen_impl::create_target_machine()
+{
+    trace_scope scope("emit", "target init");
+    static std::once_flag _is_initialized;
+
+    // Initialize the target registry etc. (visitors may start on several threads)
+    std::call_once(_is_initialized, []()
+    {
+        InitializeAllTargetInfos();
+        InitializeAllTargets();
+        InitializeAllTargetMCs();
+        InitializeAllAsmParsers();
+        InitializeAllAsmPrinters();
+    });
+
+    std::string target_triple = sys::getDefaultTargetTriple();
+
+    std::string error;
+    const Target* target = TargetRegistry::lookupTarget(target_triple, error);
+    if (!target)
+    {
+        errs() << "[ERROR] " << error << "\n";
+        return 1;
+    }
+
+    // -march=native / -mcpu=native: the host CPU with everything it supports,
+    // followed by the -mattr features so that those take precedence.
+    std::string cpu = options.cpu;
+    SubtargetFeatures features;
+
+    if (cpu == "native")
+    {
+        cpu = sys::getHostCPUName().str();
+        StringMap<bool> host_features;
+        if (sys::getHostCPUFeatures(host_features))
+            for (auto& feature : host_features)
+                features.AddFeature(feature.first(), feature.second);
+    }
+
+    SmallVector<StringRef, 8> attributes;
+    StringRef(options.features).split(attributes, ',', -1, false);
+    for (StringRef attribute : attributes)
+        features.AddFeature(attribute);
+
+    TargetOptions target_options;
+    if (options.fp_contract_fast)
+        target_options.AllowFPOpFusion = FPOpFusion::Fast;
+
+    CodeGenOpt::Level level =
+        options.opt_level <= 0 ? CodeGenOpt::None :
+        options.opt_level == 1 ? CodeGenOpt::Less :
+        options.opt_level == 2 ? CodeGenOpt::Default :
+                                 CodeGenOpt::Aggressive;
+
+    target_machine.reset(target->createTargetMachine(
+        target_triple, cpu, features.getString(), target_options, Optional<Reloc::Model>(), None, level));
+
+    if (!target_machine || !target_machine->getMCSubtargetInfo()->isCPUStringValid(cpu))
+    {
+        fprintf(diagnostic_stream(), "[ERROR] Unknown CPU \"%s\" for target \"%s\".\n", cpu.c_str(), target_triple.c_str());
+        target_machine.reset();
+        return 1;
+    }
+
+    return 0;
+}
+
+void codegen_visitor::codegen_impl::create_module()
+{
+    // Tear down the builder bound to the previous module first.
+    debugger.reset();
+
+    module = std::make_unique<Module>("kaleidoscope", context);
+    module->setSourceFileName(source_filename);
+    module->setTargetTriple(target_machine->getTargetTriple().str());
+    module->setDataLayout(target_machine->createDataLayout());
+    function_table.clear();
+    debugger = std::make_unique<DIBuilder>(*module);
+
+    // A link takes the debug info of its sources.
+    if (!options.debug_info || options.lto == lto_link) return;
+
+    module->addModuleFlag(
+        llvm::Module::Warning,
+        "Debug Info Version",
+        DEBUG_METADATA_VERSION);
+    module->addModuleFlag(
+        llvm::Module::Warning,
+        "Dwarf Version", 2);
+    dbltype = debugger->createBasicType(
+        "double", 64, dwarf::DW_ATE_float);
+    compile_unit = debugger->createCompileUnit(
+        dwarf::DW_LANG_C, debugger->createFile(source_filename.empty() ? "<stdin>" : source_filename, "."),
+        "kaleidoscope", options.opt_level > 0, "", 0);
+    current_scope = nullptr;
+    unset_debug_location_info(); // drop locations scoped to the previous module
+    debugger->finalize();
+}
 
-codegen_visitor::codegen_visitor(const char* source_filename)
+// Only the exported functions of a linked program stay external; the
+// others can be inlined into their callers and dropped.
+void codegen_visitor::codegen_impl::internalize()
+{
+    if (options.exports.empty()) return;
+
+    StringSet<> exported;
+    for (const std::string& name : options.exports)
+        exported.insert(name);
+
+    trace_scope scope("link", "internalize");
+    internalizeModule(*module, [&exported](const GlobalValue& value) { return exported.count(value.getName()) != 0; });
+}
+
+void codegen_visitor::codegen_impl::optimize_module()
+{
+    optimization_level level =
+        options.opt_level <= 0 ? optimization_level::O0 :
+        options.opt_level == 1 ? optimization_level::O1 :
+        options.opt_level == 2 ? optimization_level::O2 :
+                                 optimization_level::O3;
+
+    // Vectorizers are off in the default tuning; enable them as clang does.
+    PipelineTuningOptions tuning;
+    tuning.LoopUnrolling = true;
+    tuning.LoopInterleaving = options.opt_level >= 2;
+    tuning.LoopVectorization = options.opt_level >= 2;
+    tuning.SLPVectorization = options.opt_level >= 2;
+
+    trace_scope scope("optimize", "module");
+    PassInstrumentationCallbacks callbacks;
+    std::vector<uint64_t> starts;
+    if (trace_enabled())
+        register_trace_callbacks(callbacks, starts);
+
+    // The target machine supplies TargetTransformInfo (vector width, FMA, costs).
+    PassBuilder builder(target_machine.get(), tuning, None, &callbacks);
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    builder.registerModuleAnalyses(MAM);
+    builder.registerCGSCCAnalyses(CGAM);
+    builder.registerFunctionAnalyses(FAM);
+    builder.registerLoopAnalyses(LAM);
+    builder.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    // Self-recursion in tail position becomes a loop at every level, -O0
+    // included, so that it runs in constant stack space.
+    ModulePassManager MPM;
+    MPM.addPass(createModuleToFunctionPassAdaptor(TailCallElimPass()));
+
+    // Inlining, LICM, unrolling, vectorization, GlobalDCE etc. over the whole
+    // module. A source of a link is only simplified, the rest waits for the
+    // whole program.
+    if (options.opt_level > 0)
+    {
+#if LLVM_VERSION_MAJOR < 13
+        if (options.lto == lto_prelink)
+            MPM.addPass(builder.buildLTOPreLinkDefaultPipeline(level, false));
+        else if (options.lto == lto_link)
+            MPM.addPass(builder.buildLTODefaultPipeline(level, false, nullptr));
+#else
+        if (options.lto == lto_prelink)
+            MPM.addPass(builder.buildLTOPreLinkDefaultPipeline(level));
+        else if (options.lto == lto_link)
+            MPM.addPass(builder.buildLTODefaultPipeline(level, nullptr));
+#endif
+        else
+            MPM.addPass(builder.buildPerModuleDefaultPipeline(level));
+    }
+    MPM.run(*module, MAM);
+}
+
+codegen_visitor::codegen_impl::function_proto& codegen_visitor::codegen_impl::get_proto(int name)
+{
+    if ((size_t)name >= function_protos.size())
+        function_protos.resize(std::max(symbol_count(), (size_t)name + 1));
+    return function_protos[name];
+}
+
+void codegen_visitor::codegen_impl::record_proto(function_declaration_node* node)
+{
+    if (node->name == empty_symbol) return;
+
+    auto& proto = get_proto(node->name);
+    proto.arguments.clear();
+    proto.arrays.clear();
+    for (variable_node* child : *node->arguments)
+    {
+        proto.arguments.push_back(child->name);
+        proto.arrays.push_back(child->is_array);
+    }
+    proto.declared = true;
+}
+
+Function* codegen_visitor::codegen_impl::get_function(int name)
+{
+    // The function is already declared in the current module.
+    if (Function* function = function_table.get(name))
+        return function;
+
+    // Otherwise re-declare a function compiled into an earlier module.
+    if ((size_t)name >= function_protos.size() || !function_protos[name].declared)
+        return nullptr;
+
+    const function_proto& proto = function_protos[name];
+    Function* function = create_function(symbol_name(name), proto.arguments, proto.arrays);
+
+    function_table.set(name, function);
+    return function;
+}
+
+// An index made of loop counters and integer literals, e.g. a[i + 1], is
+// computed on the integers the counters are, as i64; nullptr otherwise.
+Value* codegen_visitor::codegen_impl::integer_index(ast_node* node)
+{
+    node_probe probe(node);
+    int64_t value;
+    if (probe.variable)
+        return counter_table.get(probe.variable->name);
+    if (is_integer(node, value))
+        return ConstantInt::get(Type::getInt64Ty(context), value, true);
+    if (!probe.binary || (probe.binary->operation != '+' && probe.binary->operation != '-'))
+        return nullptr;
+
+    // Counters and literals stay within 2^54, their sums do not wrap.
+    Value* lhs = integer_index(probe.binary->lhs);
+    Value* rhs = lhs ? integer_index(probe.binary->rhs) : nullptr;
+    if (!lhs || !rhs) return nullptr;
+    if (isa<Constant>(lhs) && isa<Constant>(rhs)) return nullptr; // only literals: no counter involved
+    return probe.binary->operation == '+' ? builder.CreateNSWAdd(lhs, rhs) : builder.CreateNSWSub(lhs, rhs);
+}
+
+Function* codegen_visitor::codegen_impl::create_function(const std::string& name, const std::vector<int>& arguments, const std::vector<bool>& arrays)
+{
+    // Numbers are doubles, arrays pointers to doubles.
+    Type* ret_type = Type::getDoubleTy(context);
+    std::vector<Type*> args_types;
+    for (bool is_array : arrays)
+        args_types.push_back(is_array ? Type::getDoublePtrTy(context) : Type::getDoubleTy(context));
+    FunctionType* function_type = FunctionType::get(ret_type, args_types, false);
+    Function* function = Function::Create(function_type, Function::ExternalLinkage, name, *module);
+
+    for (Argument& argument : function->args())
+    {
+        argument.setName(symbol_name(arguments[argument.getArgNo()]));
+
+        // Arrays do not overlap (as with C restrict) and only their elements
+        // are read and written, which lets the loops over them vectorize.
+        if (arrays[argument.getArgNo()])
+        {
+            argument.addAttr(Attribute::NoAlias);
+            argument.addAttr(Attribute::NoCapture);
+            argument.addAttr(Attribute::getWithAlignment(context, Align(sizeof(double))));
+        }
+    }
+
+    return function;
+}
+
+int codegen_visitor::codegen_impl::initialize_jit()
+{
+    // Compile for the same CPU and features as the optimizer assumed.
+    auto machine_builder = orc::JITTargetMachineBuilder::detectHost();
+    if (!machine_builder)
+    {
+        errs() << "[ERROR] Cannot detect host: " << toString(machine_builder.takeError()) << "\n";
+        return 1;
+    }
+    machine_builder->setCPU(target_machine->getTargetCPU().str());
+    machine_builder->addFeatures({ target_machine->getTargetFeatureString().str() });
+    machine_builder->setCodeGenOptLevel(target_machine->getOptLevel());
+    machine_builder->getOptions() = target_machine->Options;
+
+    auto builder = orc::LLJITBuilder()
+        .setJITTargetMachineBuilder(std::move(*machine_builder))
+        .create();
+    if (!builder)
+    {
+        errs() << "[ERROR] Cannot create JIT: " << toString(builder.takeError()) << "\n";
+        return 1;
+    }
+    jit = std::move(*builder);
+
+    // Resolve extern functions (e.g. sin, cos) against the symbols of this process.
+    auto generator = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        jit->getDataLayout().getGlobalPrefix());
+    if (!generator)
+    {
+        errs() << "[ERROR] Cannot resolve host symbols: " << toString(generator.takeError()) << "\n";
+        return 1;
+    }
+    jit->getMainJITDylib().addGenerator(std::move(*generator));
+
+    // Calls between functions go through stubs, so that a redefinition
+    // only has to patch the stub of the function redefined.
+    const Triple& triple = target_machine->getTargetTriple();
+    auto call_through_manager = orc::createLocalLazyCallThroughManager(
+        triple, jit->getExecutionSession(), pointerToJITTargetAddress(&report_call_through_error));
+    if (!call_through_manager)
+    {
+        errs() << "[ERROR] Cannot create JIT stubs: " << toString(call_through_manager.takeError()) << "\n";
+        return 1;
+    }
+    call_through = std::move(*call_through_manager);
+    stubs = orc::createLocalIndirectStubsManagerBuilder(triple)();
+
+    return 0;
+}
+
+int codegen_visitor::codegen_impl::redirect(int name, const std::string& body)
+{
+    orc::JITDylib& library = jit->getMainJITDylib();
+    orc::MangleAndInterner mangle(jit->getExecutionSession(), jit->getDataLayout());
+    orc::SymbolStringPtr stub_name = mangle(symbol_name(name));
+
+    if (get_proto(name).version == 1)
+    {
+        // First definition: the stub compiles the body on its first call.
+        orc::SymbolAliasMap aliases;
+        aliases[stub_name] = orc::SymbolAliasMapEntry(mangle(body), JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+        if (Error error = library.define(orc::lazyReexports(*call_through, *stubs, library, std::move(aliases))))
+        {
+            errs() << "[ERROR] " << toString(std::move(error)) << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // Redefinition: compile the new body now and point the stub at it. The
+    // stub is only created once something links against it, so do that first.
+    auto stub = jit->lookup(symbol_name(name));
+    if (!stub)
+    {
+        errs() << "[ERROR] " << toString(stub.takeError()) << "\n";
+        return 1;
+    }
+    auto address = jit->lookup(body);
+    if (!address)
+    {
+        errs() << "[ERROR] " << toString(address.takeError()) << "\n";
+        return 1;
+    }
+    if (Error error = stubs->updatePointer(*stub_name, address->getAddress()))
+    {
+        errs() << "[ERROR] " << toString(std::move(error)) << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int codegen_visitor::codegen_impl::execute(Function* function)
+{
+    // Nothing to compile for an extern declaration.
+    if (function->empty()) return 0;
+
+    std::string name = function->getName().str();
+    trace_scope scope("jit", "execute", name.c_str());
+
+    // Do not hand broken IR to the JIT.
+    if (verifyModule(*module, &errs()))
+    {
+        int symbol = body_symbol(name);
+        fprintf(diagnostic_stream(), "[ERROR] Invalid code generated for function \"%s\".\n", symbol > empty_symbol ? symbol_name(symbol) : name.c_str());
+        if (symbol > empty_symbol)
+        {
+            // A redefinition that fails leaves the previous version in place.
+            auto& proto = get_proto(symbol);
+            if (--proto.version == 0)
+                proto.declared = proto.defined = false;
+            function_table.set(symbol, nullptr);
+        }
+        function->eraseFromParent();
+        return 1;
+    }
+
+    debugger->finalize();
+    optimize_module();
+
+    if (options.emit_ir)
+    {
+        function->print(outs()); // dump info
+        outs().flush();
+    }
+
+    // The module is owned by the JIT from now on; continue in a fresh one.
+    Error error = jit->addIRModule(orc::ThreadSafeModule(std::move(module), ts_context));
+    create_module();
+
+    if (error)
+    {
+        errs() << "[ERROR] " << toString(std::move(error)) << "\n";
+        return 1;
+    }
+
+    // Named functions are compiled lazily on their first call.
+    if (name.compare(0, strlen(anonymous_prefix), anonymous_prefix) != 0)
+        return redirect(body_symbol(name), name);
+
+    auto symbol = jit->lookup(name);
+    if (!symbol)
+    {
+        errs() << "[ERROR] " << toString(symbol.takeError()) << "\n";
+        return 1;
+    }
+
+    double (*expression)() = (double (*)())(intptr_t)symbol->getAddress();
+    fprintf(stdout, "%lf\n", expression());
+    fflush(stdout);
+
+    return 0;
+}
+
+
+codegen_visitor::codegen_visitor(const char* source_filename, const codegen_options& options)
 {
     if (!impl)
     {
         impl = new codegen_impl();
-        impl->module.setSourceFileName(source_filename);
-#ifdef FUNCTION_OPT
-        // Promote allocas to registers.
-        impl->FPM.add(createPromoteMemoryToRegisterPass());
-        // Do simple "peephole" optimizations and bit-twiddling optzns.
-        impl->FPM.add(createInstructionCombiningPass());
-        // Reassociate expressions.
-        impl->FPM.add(createReassociatePass());
-        // Eliminate Common SubExpressions.
-        impl->FPM.add(createGVNPass());
-        // Simplify the control flow graph (deleting unreachable blocks, etc).
-        impl->FPM.add(createCFGSimplificationPass());
-        impl->FPM.doInitialization();
-#endif // FUNCTION_OPT
-#ifdef DEBUG_INFO
-        impl->module.addModuleFlag(
-            llvm::Module::Warning,
-            "Debug Info Version",
-            DEBUG_METADATA_VERSION);
-        impl->module.addModuleFlag(
-            llvm::Module::Warning,
-            "Dwarf Version", 2);
-        impl->dbltype = impl->debugger.createBasicType(
-            "double", 64, dwarf::DW_ATE_float);
-        impl->compile_unit = impl->debugger.createCompileUnit(
-            dwarf::DW_LANG_C, impl->debugger.createFile(source_filename, "."),
-            "kaleidoscope", false, "", 0);
-        impl->debugger.finalize();
-#endif // DEBUG_INFO
+        impl->options = options;
+        if (source_filename) impl->source_filename = source_filename;
+        if (options.fp_contract_fast)
+        {
+            // Allow a*b+c to become an FMA where the target has one.
+            FastMathFlags flags;
+            flags.setAllowContract(true);
+            impl->builder.setFastMathFlags(flags);
+        }
     }
 }
 
@@ -141,88 +969,177 @@ codegen_visitor::~codegen_visitor()
     }
 }
 
-void codegen_visitor::initialize()
+int codegen_visitor::initialize()
 {
     if (impl)
     {
         impl->value_stack.clear();
-        impl->value_table.clear();
+        impl->clear_variables();
+        if (!impl->target_machine)
+        {
+            if (impl->create_target_machine() != 0) return 1;
+            impl->create_module();
+        }
+        if (impl->options.jit && !impl->jit)
+            return impl->initialize_jit();
     }
+
+    return 0;
 }
 
-void codegen_visitor::terminate()
+void codegen_visitor::declare(function_declaration_node* node)
 {
     if (impl)
     {
-#ifdef OUTPUT_IR
-        impl->module.print(outs(), nullptr);
-#endif
-#ifdef GENERATE_OBJECT
-        if (impl->module.getSourceFileName().empty()) return;
-        std::string output_filename = impl->module.getSourceFileName() + ".o";
-        generate_target_code(impl->module, output_filename);
-#endif
+        impl->record_proto(node);
     }
 }
 
+int codegen_visitor::emit(std::string& object_code, std::string* ir_text)
+{
+    if (!impl) return 1;
+
+    impl->debugger->finalize();
+    if (impl->options.stop_after >= phase_optimize)
+        impl->optimize_module();
+
+    if (ir_text)
+    {
+        raw_string_ostream ir_stream(*ir_text);
+        impl->module->print(ir_stream, nullptr);
+    }
+
+    if (impl->options.stop_after < phase_emit)
+        return 0;
+
+    if (impl->options.lto == lto_prelink)
+    {
+        trace_scope scope("emit", "bitcode");
+        object_code.clear();
+        raw_string_ostream dest(object_code);
+        WriteBitcodeToFile(*impl->module, dest);
+        dest.flush();
+        return 0;
+    }
+
+    SmallVector<char, 0> buffer;
+    raw_svector_ostream dest(buffer);
+    if (generate_target_code(*impl->module, *impl->target_machine, dest) != 0)
+        return 1;
+    object_code.assign(buffer.begin(), buffer.end());
+
+    return 0;
+}
+
+int codegen_visitor::terminate()
+{
+    if (!impl) return 1;
+
+    // Everything has been compiled and run by the JIT already.
+    if (impl->options.jit) return 0;
+
+    if (impl->options.stop_after < phase_codegen) return 0;
+
+    impl->debugger->finalize();
+    if (impl->options.lto == lto_link)
+        impl->internalize();
+    if (impl->options.stop_after >= phase_optimize)
+        impl->optimize_module(); // once, over the whole module
+
+    if (impl->options.emit_ir)
+        impl->module->print(outs(), nullptr);
+    if (impl->options.emit_object && impl->options.stop_after >= phase_emit && !impl->module->getSourceFileName().empty())
+    {
+        std::string output_filename = impl->options.output;
+        if (output_filename.empty())
+            output_filename = impl->module->getSourceFileName() + ".o";
+        return generate_target_code(*impl->module, *impl->target_machine, output_filename);
+    }
+    return 0;
+}
+
+
+int codegen_visitor::link(const std::string& bitcode, const char* name)
+{
+    if (!impl) return 1;
+
+    trace_scope scope("link", "merge", name);
+
+    Expected<std::unique_ptr<Module>> source = parseBitcodeFile(MemoryBufferRef(bitcode, name), impl->context);
+    if (!source)
+    {
+        consumeError(source.takeError());
+        fprintf(diagnostic_stream(), "[ERROR] \"%s\" is not LLVM bitcode.\n", name);
+        return 1;
+    }
+
+    impl->context.setDiagnosticHandlerCallBack(report_link_diagnostic);
+    if (Linker::linkModules(*impl->module, std::move(*source)))
+    {
+        fprintf(diagnostic_stream(), "[ERROR] Cannot link \"%s\".\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
 
 int codegen_visitor::visit(top_level_node* node)
 {
+    if (impl->options.stop_after < phase_codegen)
+        return 0;
+
     if (node->content->accept(this) != 0)
         return 1;
     Value* content = impl->pop_value();
 
-#ifdef OUTPUT_IR
-#ifndef DEBUG_INFO
-    content->print(outs()); // dump info
-    std::cout << std::endl;
-#endif
-#endif
-
     impl->value_stack.clear();
+
+    if (impl->options.jit)
+        return impl->execute(static_cast<Function*>(content));
+
     return 0;
 }
 
 int codegen_visitor::visit(number_node* node)
 {
-    double dvalue = std::stod(std::string(node->value));
-
-#ifdef DEBUG_INFO
     impl->set_debug_location_info(node);
-#endif
 
-    impl->push_value(ConstantFP::get(impl->context, APFloat(dvalue)));
+    impl->push_value(ConstantFP::get(impl->context, APFloat(node->number)));
     return 0;
 }
 
 int codegen_visitor::visit(variable_node* node)
 {
-    auto iter = impl->value_table.find(std::string(node->name));
-
-    if (iter == impl->value_table.end())
+    if (!impl->variable_types.get(node->name))
     {
-        fprintf(stderr, "[ERROR] Unknown variable \"%s\".\n", node->name);
+        fprintf(diagnostic_stream(), "[ERROR] Unknown variable \"%s\".\n", symbol_name(node->name));
         return 1;
     }
 
-#ifdef DEBUG_INFO
     impl->set_debug_location_info(node);
-#endif
 
-    impl->push_value(impl->builder.CreateLoad(iter->second)); // load from var's address
+    impl->push_value(impl->use_variable(node->name)); // a number or an array
     return 0;
 }
 
 int codegen_visitor::visit(binary_expression_node* node)
 {
+    // The right operand of & and | is evaluated only if the left one does
+    // not decide the value, unless it is cheap and harmless to evaluate.
+    if ((node->operation == '&' || node->operation == '|') && !pure_probe(node->rhs, speculation_budget).pure)
+        return visit_short_circuit(node);
+
     if (node->lhs->accept(this) != 0)
         return 1;
     if (node->rhs->accept(this) != 0)
         return 1;
 
+    bool tail = impl->tail_node == node;
     Value* valrep {nullptr};
-    Value* rval = impl->pop_value();
-    Value* lval = impl->pop_value();
+    Value* rval = impl->pop_number();
+    Value* lval = impl->pop_number();
+    if (!rval || !lval) return 1;
 
     switch (node->operation)
     {
@@ -259,37 +1176,97 @@ int codegen_visitor::visit(binary_expression_node* node)
         valrep = impl->builder.CreateUIToFP(valrep, Type::getDoubleTy(impl->context), "booltmp");
         break;
     default:
-        fprintf(stderr, "[ERROR] Invalid operation \"%c\".\n", node->operation);
+        fprintf(diagnostic_stream(), "[ERROR] Invalid operation \"%c\".\n", node->operation);
     }
 
     if (!valrep) return 1;
 
-#ifdef DEBUG_INFO
+    // -ftail-accumulate: in "return x * f(...)" with f the current function,
+    // let the multiplication be reassociated, so that tail recursion
+    // elimination can carry it in an accumulator. The order of the
+    // operations changes, hence the rounding.
+    if (tail && impl->options.tail_accumulate && (node->operation == '+' || node->operation == '*'))
+    {
+        node_probe lhs(node->lhs);
+        node_probe rhs(node->rhs);
+        bool recursive = (lhs.call && lhs.call->callee == impl->current_name) || (rhs.call && rhs.call->callee == impl->current_name);
+        if (Instruction* instruction = dyn_cast<Instruction>(valrep))
+        {
+            if (recursive)
+            {
+                instruction->setHasAllowReassoc(true);
+                instruction->setHasNoSignedZeros(true);
+            }
+        }
+    }
+
     impl->set_debug_location_info(node);
-#endif
 
     impl->push_value(valrep);
     return 0;
 }
 
+int codegen_visitor::visit_short_circuit(binary_expression_node* node)
+{
+    Function* function = impl->builder.GetInsertBlock()->getParent();
+    bool is_and = node->operation == '&';
+
+    BasicBlock* rhs_block = BasicBlock::Create(impl->context, is_and ? "and.rhs" : "or.rhs");
+    BasicBlock* merg_block = BasicBlock::Create(impl->context, is_and ? "and.merge" : "or.merge");
+
+    if (node->lhs->accept(this) != 0)
+        return 1;
+    Value* lval = impl->pop_number();
+    if (!lval) return 1;
+    lval = impl->builder.CreateFCmpONE(lval, ConstantFP::get(impl->context, APFloat(0.0)), "neqtmp");
+    BasicBlock* lhs_block = impl->builder.GetInsertBlock();
+    if (is_and)
+        impl->builder.CreateCondBr(lval, rhs_block, merg_block);
+    else
+        impl->builder.CreateCondBr(lval, merg_block, rhs_block);
+    impl->seal_block(rhs_block);
+
+    function->getBasicBlockList().push_back(rhs_block);
+    impl->builder.SetInsertPoint(rhs_block);
+    if (node->rhs->accept(this) != 0)
+        return 1;
+    Value* rval = impl->pop_number();
+    if (!rval) return 1;
+    rval = impl->builder.CreateFCmpONE(rval, ConstantFP::get(impl->context, APFloat(0.0)), "neqtmp");
+    impl->builder.CreateBr(merg_block);
+    BasicBlock* phi_pred_rhs = impl->builder.GetInsertBlock();
+
+    impl->seal_block(merg_block);
+
+    function->getBasicBlockList().push_back(merg_block);
+    impl->builder.SetInsertPoint(merg_block);
+    impl->set_debug_location_info(node);
+    PHINode* phi = impl->builder.CreatePHI(Type::getInt1Ty(impl->context), 2, is_and ? "andtmp" : "ortmp");
+    phi->addIncoming(is_and ? impl->builder.getFalse() : impl->builder.getTrue(), lhs_block);
+    phi->addIncoming(rval, phi_pred_rhs);
+
+    impl->push_value(impl->builder.CreateUIToFP(phi, Type::getDoubleTy(impl->context), "booltmp"));
+    return 0;
+}
+
 int codegen_visitor::visit(call_function_node* node)
 {
-    Function* callee = impl->module.getFunction(node->callee);
+    Function* callee = impl->get_function(node->callee);
 
     if (!callee)
     {
-        fprintf(stderr, "[ERROR] Unknown referenced function \"%s\".\n", node->callee);
+        fprintf(diagnostic_stream(), "[ERROR] Unknown referenced function \"%s\".\n", symbol_name(node->callee));
         return 1;
     }
 
-    if (callee->arg_size() != size(node->arguments))
+    if (callee->arg_size() != node->arguments->size())
     {
-        fprintf(stderr, "[ERROR] Incorrect number of arguments passed to the function \"%s\".\n", node->callee);
+        fprintf(diagnostic_stream(), "[ERROR] Incorrect number of arguments passed to the function \"%s\".\n", symbol_name(node->callee));
         return 1;
     }
 
-    for (auto* child = first(node->arguments); child != nullptr; child = next(child))
-        if (data(child)->accept(this) != 0)
+    for (ast_node* child : *node->arguments)
+        if (child->accept(this) != 0)
             return 1;
 
     std::vector<Value*> arguments;
@@ -297,32 +1274,64 @@ int codegen_visitor::visit(call_function_node* node)
         arguments.push_back(impl->pop_value());
     std::reverse(arguments.begin(), arguments.end());
 
-#ifdef DEBUG_INFO
+    for (size_t i = 0; i < arguments.size(); ++i)
+    {
+        if (arguments[i]->getType() != callee->getArg(i)->getType())
+        {
+            fprintf(diagnostic_stream(), "[ERROR] Argument %zu of the function \"%s\" must be %s.\n", i + 1, symbol_name(node->callee),
+                callee->getArg(i)->getType()->isPointerTy() ? "an array" : "a number");
+            return 1;
+        }
+    }
+
     impl->set_debug_location_info(node);
-#endif
 
-    impl->push_value(impl->builder.CreateCall(callee, arguments, "calltmp"));
+    CallInst* call = impl->builder.CreateCall(callee, arguments, "calltmp");
+
+    // A call in tail position to a function of the same type is a
+    // guaranteed tail call: mutual recursion runs in constant stack space.
+    if (impl->tail_node == node)
+    {
+        Function* caller = impl->builder.GetInsertBlock()->getParent();
+        if (callee->getFunctionType() == caller->getFunctionType() && callee->getCallingConv() == caller->getCallingConv())
+        {
+            call->setTailCallKind(CallInst::TCK_MustTail);
+            impl->builder.CreateRet(call);
+            impl->returned = true;
+        }
+        else
+        {
+            call->setTailCall();
+        }
+    }
+
+    impl->push_value(call);
     return 0;
 }
 
 int codegen_visitor::visit(function_declaration_node* node)
 {
-    Type* ret_type = Type::getDoubleTy(impl->context);
-    std::vector<Type*> args_types(size(node->arguments), Type::getDoubleTy(impl->context));
-    FunctionType* function_type = FunctionType::get(ret_type, args_types, false);
-    Function* function = Function::Create(function_type, Function::ExternalLinkage, node->name, impl->module);
+    std::string name(symbol_name(node->name));
 
-    if (!function) return 1;
+    // The JIT looks anonymous expressions up by name, so give them one.
+    if (node->name == empty_symbol && impl->options.jit)
+        name = anonymous_prefix + std::to_string(++impl->anonymous_count);
 
-    auto* child = first(node->arguments);
-    for (Argument& argument : function->args())
+    std::vector<int> arguments;
+    std::vector<bool> arrays;
+    for (variable_node* child : *node->arguments)
     {
-        argument.setName(data(child)->name);
-        child = next(child);
+        arguments.push_back(child->name);
+        arrays.push_back(child->is_array);
     }
 
-#ifdef DEBUG_INFO
-#endif
+    Function* function = impl->create_function(name, arguments, arrays);
+
+    if (!function) return 1;
+
+    impl->record_proto(node);
+    if (node->name != empty_symbol && !impl->function_table.get(node->name))
+        impl->function_table.set(node->name, function);
 
     impl->push_value(function);
     return 0;
@@ -330,7 +1339,8 @@ int codegen_visitor::visit(function_declaration_node* node)
 
 int codegen_visitor::visit(function_definition_node* node)
 {
-    Function *function = impl->module.getFunction(node->declaration->name);
+    trace_scope scope("codegen", "function", node->declaration->name != empty_symbol ? symbol_name(node->declaration->name) : nullptr);
+    Function *function = impl->get_function(node->declaration->name);
 
     if (!function)
     {
@@ -338,78 +1348,122 @@ int codegen_visitor::visit(function_definition_node* node)
         function = static_cast<Function*>(impl->pop_value());
     }
 
-    if (!function->empty())
+    int name = node->declaration->name;
+    auto& proto = impl->get_proto(name);
+    const std::vector<int>& arguments = proto.arguments;
+
+    if (!function->empty() || (proto.defined && !impl->options.jit))
     {
-        fprintf(stderr, "[ERROR] Redefined function \"%s\".\n", node->declaration->name);
+        fprintf(diagnostic_stream(), "[ERROR] Redefined function \"%s\".\n", symbol_name(name));
         return 1;
     }
 
+    if (impl->options.jit && name != empty_symbol)
+    {
+        // Callers compiled so far pass the old arguments.
+        bool same_arguments = node->declaration->arguments->size() == arguments.size();
+        for (size_t i = 0; same_arguments && i < arguments.size(); ++i)
+            same_arguments = (*node->declaration->arguments)[i]->is_array == proto.arrays[i];
+        if (proto.defined && !same_arguments)
+        {
+            fprintf(diagnostic_stream(), "[ERROR] Redefined function \"%s\" with different arguments.\n", symbol_name(name));
+            return 1;
+        }
+
+        // The new body gets a name of its own, the stub keeps the old one.
+        impl->record_proto(node->declaration);
+        function->setName(std::string(symbol_name(name)) + "." + std::to_string(++proto.version));
+        for (Argument& argument : function->args())
+            argument.setName(symbol_name(arguments[argument.getArgNo()]));
+    }
+
+    // Let per-function consumers (e.g. a later link step) see the target too.
+    function->addFnAttr("target-cpu", impl->target_machine->getTargetCPU());
+    function->addFnAttr("target-features", impl->target_machine->getTargetFeatureString());
+
     // Create a new basic block to start insertion into.
     BasicBlock *block = BasicBlock::Create(impl->context, "entry", function);
     impl->builder.SetInsertPoint(block);
+    impl->unset_debug_location_info(); // a failed definition may have left its location behind
 
-    // Record the function arguments in the NamedValues map.
-    impl->value_table.clear();
+    // Record the function arguments as the first definitions of their variables.
+    impl->clear_variables();
+    impl->seal_block(block);
 
     for (Argument& argument : function->args())
+        impl->define_variable(arguments[argument.getArgNo()], &argument);
+
+    if (impl->options.debug_info)
     {
-        //impl->value_table[argument.getName()] = &argument;
-        AllocaInst* address = impl->builder.CreateAlloca(Type::getDoubleTy(impl->context), nullptr, argument.getName());
-        impl->value_table[argument.getName()] = address;
-        impl->builder.CreateStore(&argument, address);
-    }
-
-#ifdef DEBUG_INFO
-    // Create a subprogram DIE for this function.
-    unsigned int lineno = node->row;
-    DIFile* file_unit = impl->debugger.createFile(
-        impl->compile_unit->getFilename(), impl->compile_unit->getDirectory());
-    DIType* dbltype = impl->dbltype;
-    SmallVector<Metadata*, 8> dbltypes;
-    dbltypes.push_back(dbltype); // Add the result type.
-    for (int i = 0; i < function->arg_size(); ++i)
-        dbltypes.push_back(dbltype);
-    DISubroutineType* subrtype = impl->debugger.createSubroutineType(
-        impl->debugger.getOrCreateTypeArray(dbltypes));
-    DISubprogram* subprog = impl->debugger.createFunction(
-        file_unit, node->declaration->name, StringRef(), file_unit, lineno,
-        subrtype, lineno, DINode::FlagPrototyped, DISubprogram::SPFlagDefinition);
-    function->setSubprogram(subprog);
-    impl->current_scope = subprog;
-    impl->unset_debug_location_info();
-    for (int i = 0; i < function->arg_size(); ++i)
-    {
-        AllocaInst* address = impl->value_table[function->getArg(i)->getName()];
-        DILocalVariable* localvar = impl->debugger.createParameterVariable(
-            subprog, function->getArg(i)->getName(), i+1, file_unit, lineno, dbltype, true);
-        impl->debugger.insertDeclare(address, localvar, impl->debugger.createExpression(),
-            DILocation::get(subprog->getContext(), lineno, 0, subprog), impl->builder.GetInsertBlock());
-    }
-    impl->debugger.finalizeSubprogram(subprog);
-#endif // DEBUG_INFO
-
-    if (node->definition->accept(this) != 0)
+        // Create a subprogram DIE for this function.
+        unsigned int lineno = node->row;
+        DIFile* file_unit = impl->debugger->createFile(
+            impl->compile_unit->getFilename(), impl->compile_unit->getDirectory());
+        DIType* dbltype = impl->dbltype;
+        DIType* ptrtype = impl->debugger->createPointerType(dbltype, 64);
+        SmallVector<Metadata*, 8> dbltypes;
+        dbltypes.push_back(dbltype); // Add the result type.
+        for (int i = 0; i < function->arg_size(); ++i)
+            dbltypes.push_back(proto.arrays[i] ? ptrtype : dbltype);
+        DISubroutineType* subrtype = impl->debugger->createSubroutineType(
+            impl->debugger->getOrCreateTypeArray(dbltypes));
+        DISubprogram* subprog = impl->debugger->createFunction(
+            file_unit, function->getName(), StringRef(), file_unit, lineno,
+            subrtype, lineno, DINode::FlagPrototyped,
+            DISubprogram::SPFlagDefinition | (impl->options.opt_level > 0 ? DISubprogram::SPFlagOptimized : DISubprogram::SPFlagZero));
+        function->setSubprogram(subprog);
+        impl->current_scope = subprog;
+        impl->unset_debug_location_info();
+        for (int i = 0; i < function->arg_size(); ++i)
+        {
+            AllocaInst* address = impl->value_table.get(arguments[i]);
+            DILocalVariable* localvar = impl->debugger->createParameterVariable(
+                subprog, function->getArg(i)->getName(), i+1, file_unit, lineno, proto.arrays[i] ? ptrtype : dbltype, true);
+            impl->debugger->insertDeclare(address, localvar, impl->debugger->createExpression(),
+                DILocation::get(subprog->getContext(), lineno, 0, subprog), impl->builder.GetInsertBlock());
+        }
+        impl->debugger->finalizeSubprogram(subprog);
+    }
+
+    Value* definition {nullptr}; // returned Value
+    impl->current_name = name;
+    impl->tail_node = node->definition;
+    impl->returned = false;
+    int status = node->definition->accept(this);
+    impl->tail_node = nullptr;
+    if (status == 0)
+        definition = impl->pop_number();
+    impl->clear_variables();
+
+    if (!definition)
     {
+        if (name != empty_symbol)
+        {
+            if (impl->options.jit) --proto.version;
+            if (!proto.defined) proto.declared = false; // a redefinition keeps the previous version
+            impl->function_table.set(name, nullptr);
+        }
         function->eraseFromParent(); // Error reading body, remove function.
         return 1;
     }
 
-    Value* definition = impl->pop_value(); // returned Value
-    impl->builder.CreateRet(definition); // Finish off the function.
+    if (!impl->returned)
+        impl->builder.CreateRet(definition); // Finish off the function.
+    impl->returned = false;
     verifyFunction(*function); // Validate the generated code, checking for consistency.
 
-    // Optimize the function(optional)
-#ifdef FUNCTION_OPT
-    impl->FPM.run(*function);
-#endif
+    if (name != empty_symbol)
+        proto.defined = true;
+
     // Remove the anonymous expression.
     //if (strcmp(node->declaration->name, "") == 0)
     //    function->eraseFromParent();
 
-#ifdef DEBUG_INFO
-    impl->set_debug_location_info(node->definition);
-    impl->current_scope = impl->compile_unit;
-#endif
+    if (impl->options.debug_info)
+    {
+        impl->set_debug_location_info(node->definition);
+        impl->current_scope = impl->compile_unit;
+    }
 
     impl->push_value(function);
     return 0;
@@ -419,16 +1473,19 @@ int codegen_visitor::visit(block_node* node)
 {
     Value* valrep {nullptr};
 
-    for (auto* child = first(node->expressions); child != nullptr; child = next(child))
+    bool tail = impl->tail_node == node;
+
+    for (size_t i = 0; i < node->expressions->size(); ++i)
     {
-        if (data(child)->accept(this) != 0)
+        ast_node* child = (*node->expressions)[i];
+        if (tail && i + 1 == node->expressions->size())
+            impl->tail_node = child; // the value of the block is the last one
+        if (child->accept(this) != 0)
             return 1;
         valrep = impl->pop_value();
     }
 
-#ifdef DEBUG_INFO
     impl->set_debug_location_info(node);
-#endif
 
     impl->push_value(valrep); // return value of the last expression
     return 0;
@@ -436,101 +1493,188 @@ int codegen_visitor::visit(block_node* node)
 
 int codegen_visitor::visit(assignment_node* node)
 {
-    Function* function = impl->builder.GetInsertBlock()->getParent();
-
     // Evaluate RHS.
     if (node->expression->accept(this) != 0)
         return 1;
-    Value* rhs = impl->pop_value();
+    Value* rhs = impl->pop_number();
+    if (!rhs) return 1;
 
     // Emit LHS i.e. the named variable.
-    auto iter = impl->value_table.find(std::string(node->variable));
-    AllocaInst* address {nullptr};
-    if (iter == impl->value_table.end())
-    {
-        // Save up the current block and make the entry block the current one.
-        BasicBlock* curr_block = impl->builder.GetInsertBlock();
-        impl->builder.SetInsertPoint(&function->getEntryBlock().front());
-        // Allocate variables in the entry block.
-        address = impl->builder.CreateAlloca(Type::getDoubleTy(impl->context), nullptr, node->variable);
-        impl->value_table[std::string(node->variable)] = address;
-        // Restore the current block
-        impl->builder.SetInsertPoint(curr_block);
-    }
-    else address = iter->second;
-    impl->builder.CreateStore(rhs, address);
-
-#ifdef DEBUG_INFO
-    unsigned int lineno = node->row, column = node->col;
-    DIFile* file_unit = impl->debugger.createFile(
-        impl->compile_unit->getFilename(), impl->compile_unit->getDirectory());
-    DILocalVariable* localvar = impl->debugger.createAutoVariable(
-        impl->current_scope, node->variable, file_unit, lineno, impl->dbltype);
-    impl->debugger.insertDeclare(address, localvar, impl->debugger.createExpression(),
-        DILocation::get(impl->compile_unit->getContext(), lineno, column, impl->current_scope),
-        impl->builder.GetInsertBlock());
-    impl->set_debug_location_info(node);
-#endif
+    Type* type = impl->variable_types.get(node->variable);
+    if (type && type->isPointerTy())
+    {
+        fprintf(diagnostic_stream(), "[ERROR] Cannot assign to the array \"%s\".\n", symbol_name(node->variable));
+        return 1;
+    }
+    impl->define_variable(node->variable, rhs);
+
+    if (impl->options.debug_info)
+    {
+        AllocaInst* address = impl->value_table.get(node->variable);
+        unsigned int lineno = node->row, column = node->col;
+        DIFile* file_unit = impl->debugger->createFile(
+            impl->compile_unit->getFilename(), impl->compile_unit->getDirectory());
+        DILocalVariable* localvar = impl->debugger->createAutoVariable(
+            impl->current_scope, symbol_name(node->variable), file_unit, lineno, impl->dbltype);
+        impl->debugger->insertDeclare(address, localvar, impl->debugger->createExpression(),
+            DILocation::get(impl->compile_unit->getContext(), lineno, column, impl->current_scope),
+            impl->builder.GetInsertBlock());
+        impl->set_debug_location_info(node);
+    }
 
     impl->push_value(rhs); // return a value instead of address
     return 0;
 }
 
+int codegen_visitor::visit(index_node* node)
+{
+    Type* type = impl->variable_types.get(node->array);
+    if (!type || !type->isPointerTy())
+    {
+        fprintf(diagnostic_stream(), "[ERROR] Unknown array \"%s\".\n", symbol_name(node->array));
+        return 1;
+    }
+
+    Value* offset = impl->integer_index(node->index);
+    if (!offset)
+    {
+        if (node->index->accept(this) != 0)
+            return 1;
+        Value* index = impl->pop_number();
+        if (!index) return 1;
+        offset = impl->builder.CreateFPToSI(index, Type::getInt64Ty(impl->context), "idx");
+    }
+
+    Value* value {nullptr};
+    if (node->value)
+    {
+        if (node->value->accept(this) != 0)
+            return 1;
+        value = impl->pop_number();
+        if (!value) return 1;
+    }
+
+    impl->set_debug_location_info(node);
+
+    // The index is truncated to an integer, as in C.
+    Type* element_type = Type::getDoubleTy(impl->context);
+    Value* array = impl->use_variable(node->array);
+    Value* element = impl->builder.CreateInBoundsGEP(element_type, array, offset, "elem");
+
+    if (value)
+    {
+        impl->builder.CreateAlignedStore(value, element, MaybeAlign(sizeof(double)));
+        impl->push_value(value); // like an assignment, the stored value
+    }
+    else
+    {
+        impl->push_value(impl->builder.CreateAlignedLoad(element_type, element, MaybeAlign(sizeof(double)), "elemval"));
+    }
+    return 0;
+}
+
 int codegen_visitor::visit(if_else_node* node)
 {
+    // Cheap branches without side effects are both evaluated and one value
+    // selected: no branch to mispredict.
+    if (pure_probe(node->then_expr, speculation_budget).pure && pure_probe(node->else_expr, speculation_budget).pure)
+        return visit_select(node);
+
     Function* function = impl->builder.GetInsertBlock()->getParent();
+    bool tail = impl->tail_node == node;
 
-    // Create blocks for the "then" and "else" cases.
+    // Create blocks for the "then" and "else" cases. In tail position each
+    // one returns its value, there is nothing to merge.
     BasicBlock* then_block = BasicBlock::Create(impl->context, "if.true");
     BasicBlock* else_block = BasicBlock::Create(impl->context, "if.false");
-    BasicBlock* merg_block = BasicBlock::Create(impl->context, "if.merge");
+    BasicBlock* merg_block = tail ? nullptr : BasicBlock::Create(impl->context, "if.merge");
 
     // Emit "condition" value
     if (node->condition->accept(this) != 0)
         return 1;
-    Value* condition = impl->pop_value(); // Convert condition to a bool by comparing non-equal to 0.0.
+    Value* condition = impl->pop_number(); // Convert condition to a bool by comparing non-equal to 0.0.
+    if (!condition) return 1;
     condition = impl->builder.CreateFCmpONE(condition, ConstantFP::get(impl->context, APFloat(0.0)), "if_cond");
 
     // Create conditional branch.
     impl->builder.CreateCondBr(condition, then_block, else_block);
+    impl->seal_block(then_block);
+    impl->seal_block(else_block);
 
     // Emit value in "then" block.
     function->getBasicBlockList().push_back(then_block); // Insert "then" block at the end of the function.
     impl->builder.SetInsertPoint(then_block);
+    if (tail) impl->tail_node = node->then_expr;
     if (node->then_expr->accept(this) != 0)
         return 1;
-    Value* then_expr = impl->pop_value();
-    impl->builder.CreateBr(merg_block);
+    Value* then_expr = impl->pop_number();
+    if (!then_expr) return 1;
+    impl->branch_or_return(merg_block, then_expr);
     BasicBlock* phi_pred_then = impl->builder.GetInsertBlock();
 
     // Emit value in "else" block.
     function->getBasicBlockList().push_back(else_block);
     impl->builder.SetInsertPoint(else_block);
+    if (tail) impl->tail_node = node->else_expr;
     if (node->else_expr->accept(this) != 0)
         return 1;
-    Value* else_expr = impl->pop_value();
-    impl->builder.CreateBr(merg_block);
+    Value* else_expr = impl->pop_number();
+    if (!else_expr) return 1;
+    impl->branch_or_return(merg_block, else_expr);
     BasicBlock* phi_pred_else = impl->builder.GetInsertBlock();
 
+    if (tail)
+    {
+        impl->returned = true;
+        impl->push_value(UndefValue::get(Type::getDoubleTy(impl->context))); // never used
+        return 0;
+    }
+
     // Emit value in "merge" block.
+    impl->seal_block(merg_block);
     function->getBasicBlockList().push_back(merg_block);
     impl->builder.SetInsertPoint(merg_block);
     PHINode* phi = impl->builder.CreatePHI(Type::getDoubleTy(impl->context), 2, "if_phi");
     phi->addIncoming(then_expr, phi_pred_then);
     phi->addIncoming(else_expr, phi_pred_else);
 
-#ifdef DEBUG_INFO
     impl->set_debug_location_info(node);
-#endif
 
     impl->push_value(phi);
     return 0;
 }
 
+int codegen_visitor::visit_select(if_else_node* node)
+{
+    if (node->condition->accept(this) != 0)
+        return 1;
+    Value* condition = impl->pop_number();
+    if (!condition) return 1;
+    condition = impl->builder.CreateFCmpONE(condition, ConstantFP::get(impl->context, APFloat(0.0)), "if_cond");
+
+    if (node->then_expr->accept(this) != 0)
+        return 1;
+    Value* then_expr = impl->pop_number();
+    if (!then_expr) return 1;
+
+    if (node->else_expr->accept(this) != 0)
+        return 1;
+    Value* else_expr = impl->pop_number();
+    if (!else_expr) return 1;
+
+    impl->set_debug_location_info(node);
+
+    impl->push_value(impl->builder.CreateSelect(condition, then_expr, else_expr, "if_select"));
+    return 0;
+}
+
 int codegen_visitor::visit(for_loop_node* node)
 {
     Function* function = impl->builder.GetInsertBlock()->getParent();
 
+    counted_loop counted;
+    bool is_counted = match_counted_loop(node, counted);
+
     BasicBlock* cond_block = BasicBlock::Create(impl->context, "for.cond"); // loop condition
     BasicBlock* loop_block = BasicBlock::Create(impl->context, "for.loop"); // loop body + step
     BasicBlock* next_block = BasicBlock::Create(impl->context, "for.term"); // where loop terminates
@@ -538,73 +1682,122 @@ int codegen_visitor::visit(for_loop_node* node)
     // Emit "init" value.
     if (node->init->accept(this) != 0)
         return 1;
-    Value* init = impl->pop_value();
+    impl->pop_value();
+
+    // A counted loop compares against the bound rounded to an integer once:
+    // for an integer v, v < b is v < ceil(b) and v > b is v > floor(b).
+    // Where b is NaN or too large the double counter would never stop or
+    // step exactly, so the limit saturates at 2^53.
+    Type* int_type = Type::getInt64Ty(impl->context);
+    Value* limit {nullptr};
+    if (is_counted)
+    {
+        if (counted.bound->accept(this) != 0)
+            return 1;
+        Value* bound = impl->pop_number();
+        if (!bound) return 1;
+
+        Constant* high = ConstantFP::get(impl->context, APFloat(exact_integer_limit));
+        Constant* low = ConstantFP::get(impl->context, APFloat(-exact_integer_limit));
+        if (counted.upward)
+        {
+            bound = impl->builder.CreateSelect(impl->builder.CreateFCmpOLT(bound, low), low, bound);
+            bound = impl->builder.CreateSelect(impl->builder.CreateFCmpUGT(bound, high), high, bound); // NaN too
+        }
+        else
+        {
+            bound = impl->builder.CreateSelect(impl->builder.CreateFCmpOGT(bound, high), high, bound);
+            bound = impl->builder.CreateSelect(impl->builder.CreateFCmpULT(bound, low), low, bound);
+        }
+
+        // Rounded from the truncation, not with ceil/floor, which are calls
+        // to libm on some targets.
+        Value* truncated = impl->builder.CreateFPToSI(bound, int_type);
+        Value* back = impl->builder.CreateSIToFP(truncated, Type::getDoubleTy(impl->context));
+        Value* adjust = counted.upward ? impl->builder.CreateFCmpOLT(back, bound) : impl->builder.CreateFCmpOGT(back, bound);
+        adjust = impl->builder.CreateZExt(adjust, int_type);
+        limit = counted.upward ?
+            impl->builder.CreateAdd(truncated, adjust, "for_limit") :
+            impl->builder.CreateSub(truncated, adjust, "for_limit");
+    }
+
+    BasicBlock* entry_block = impl->builder.GetInsertBlock();
     impl->builder.CreateBr(cond_block);
 
     // Emit "condition" value
     function->getBasicBlockList().push_back(cond_block);
     impl->builder.SetInsertPoint(cond_block);
-    if (node->cond->accept(this) != 0)
-        return 1;
-    Value* condition = impl->pop_value();
-    condition = impl->builder.CreateFCmpONE(condition, ConstantFP::get(impl->context, APFloat(0.0)), "for_cond");
+
+    // The value of the loop is the body's last value, 0 if it never ran.
+    PHINode* value_phi = impl->builder.CreatePHI(Type::getDoubleTy(impl->context), 2, "for_value");
+    value_phi->addIncoming(ConstantFP::get(impl->context, APFloat(0.0)), entry_block);
+
+    Value* condition {nullptr};
+    PHINode* counter {nullptr};
+    if (is_counted)
+    {
+        // The body sees the counter as the double it would have been.
+        counter = impl->builder.CreatePHI(int_type, 2, symbol_name(counted.variable));
+        counter->addIncoming(ConstantInt::get(int_type, counted.start, true), entry_block);
+        Value* number = impl->builder.CreateSIToFP(counter, Type::getDoubleTy(impl->context));
+        impl->define_variable(counted.variable, number);
+
+        impl->set_debug_location_info(node->cond);
+        condition = counted.upward ?
+            impl->builder.CreateICmpSLT(counter, limit, "for_cond") :
+            impl->builder.CreateICmpSGT(counter, limit, "for_cond");
+    }
+    else
+    {
+        if (node->cond->accept(this) != 0)
+            return 1;
+        condition = impl->pop_number();
+        if (!condition) return 1;
+        condition = impl->builder.CreateFCmpONE(condition, ConstantFP::get(impl->context, APFloat(0.0)), "for_cond");
+    }
     impl->builder.CreateCondBr(condition, loop_block, next_block);
+    impl->seal_block(loop_block);
+    impl->seal_block(next_block);
 
     // Emit "loop" and "step" values
     function->getBasicBlockList().push_back(loop_block);
     impl->builder.SetInsertPoint(loop_block);
-    if (node->expr->accept(this) != 0)
-        return 1;
-    Value* loop = impl->pop_value();
-    if (node->step->accept(this) != 0)
+    if (is_counted) impl->counter_table.set(counted.variable, counter);
+    int status = node->expr->accept(this);
+    if (is_counted) impl->counter_table.set(counted.variable, nullptr); // the counter is the variable inside the body only
+    if (status != 0)
         return 1;
-    impl->pop_value();
+    Value* loop = impl->pop_number();
+    if (!loop) return 1;
+    if (is_counted)
+    {
+        impl->set_debug_location_info(node->step);
+        Value* next = impl->builder.CreateNSWAdd(counter, ConstantInt::get(int_type, counted.step, true), "for_next");
+        counter->addIncoming(next, impl->builder.GetInsertBlock());
+    }
+    else
+    {
+        if (node->step->accept(this) != 0)
+            return 1;
+        impl->pop_value();
+    }
+    value_phi->addIncoming(loop, impl->builder.GetInsertBlock());
     impl->builder.CreateBr(cond_block);
+    impl->seal_block(cond_block); // the back edge is in
 
     // Terminate the loop
     function->getBasicBlockList().push_back(next_block);
     impl->builder.SetInsertPoint(next_block);
 
-#ifdef DEBUG_INFO
     impl->set_debug_location_info(node);
-#endif
 
-    impl->push_value(loop);
+    impl->push_value(value_phi);
     return 0;
 }
 
 
-static int generate_target_code(Module& module, std::string& output_filename)
+static int generate_target_code(Module& module, TargetMachine& target_machine, std::string& output_filename)
 {
-    static int _is_initialized = 0;
-
-    if (!_is_initialized)
-    {
-        // Initialize the target registry etc.
-        InitializeAllTargetInfos();
-        InitializeAllTargets();
-        InitializeAllTargetMCs();
-        InitializeAllAsmParsers();
-        InitializeAllAsmPrinters();
-        _is_initialized = 1;
-    }
-
-    auto target_triple = sys::getDefaultTargetTriple();
-    module.setTargetTriple(target_triple);
-
-    std::string error;
-    auto target = TargetRegistry::lookupTarget(target_triple, error);
-    if (!target)
-    {
-        errs() << error;
-        return 1;
-    }
-
-    TargetOptions opt;
-    auto RM = Optional<Reloc::Model>();
-    auto target_machine = target->createTargetMachine(target_triple, "generic", "", opt, RM);
-    module.setDataLayout(target_machine->createDataLayout());
-
     std::error_code error_code;
     raw_fd_ostream dest(output_filename, error_code, sys::fs::OF_None);
     if (error_code)
@@ -613,15 +1806,26 @@ static int generate_target_code(Module& module, std::string& output_filename)
         return 1;
     }
 
+    return generate_target_code(module, target_machine, dest);
+}
+
+static int generate_target_code(Module& module, TargetMachine& target_machine, raw_pwrite_stream& dest)
+{
     legacy::PassManager pass;
-    if (target_machine->addPassesToEmitFile(pass, dest, nullptr, CGFT_ObjectFile))
     {
-        errs() << "The Target Machine can't emit a file of this type" << "\n";
-        return 1;
+        trace_scope scope("emit", "addPassesToEmitFile");
+        if (target_machine.addPassesToEmitFile(pass, dest, nullptr, CGFT_ObjectFile))
+        {
+            errs() << "The Target Machine can't emit a file of this type" << "\n";
+            return 1;
+        }
     }
 
-    pass.run(module);
-    dest.flush();
+    {
+        trace_scope scope("emit", "pass.run");
+        pass.run(module);
+        dest.flush();
+    }
 
     return 0;
 }
@@ -1,20 +1,73 @@
 #ifndef KS_CODEGEN_VISITOR_HH
 #define KS_CODEGEN_VISITOR_HH
 
+#include <string>
+#include <vector>
 #include "visitor.hh"
 
 
+// Phases of a compilation, in order (see --stop-after)
+enum compile_phase
+{
+    phase_lex,
+    phase_parse,
+    phase_codegen,
+    phase_optimize,
+    phase_emit,
+};
+
+
+// Part a module plays in link-time optimization
+enum lto_stage
+{
+    lto_none,     // compiled and emitted on its own
+    lto_prelink,  // one source of a link, emitted as bitcode
+    lto_link,     // the linked sources, optimized as a whole program
+};
+
+
+// Back end settings chosen on the command line
+struct codegen_options
+{
+    int opt_level {0};              // -O0 .. -O3, run once over each module
+    bool debug_info {};             // -g, emit DWARF debug info
+    bool emit_ir {true};            // print the IR to stdout
+    bool emit_object {true};        // write <source>.o
+    bool jit {};                    // compile with the JIT and run top-level expressions
+    std::string cpu {"generic"};    // -mcpu= / -march=, "native" for the host CPU
+    std::string features;           // -mattr=, e.g. "+avx2,+fma"
+    bool fp_contract_fast {};       // -ffp-contract=fast, fuse a*b+c into FMA
+    bool tail_accumulate {};        // -ftail-accumulate, reassociate x + f(...) in f into a loop
+    compile_phase stop_after {phase_emit}; // last phase run, for benchmarking
+    std::string output;             // -o, the file written instead of <source>.o
+    lto_stage lto {lto_none};
+    std::vector<std::string> exports; // --export=, what the link keeps external (everything if empty)
+};
+
+
 class codegen_visitor : public visitor
 {
 protected:
     struct codegen_impl;
 
 public:
-    codegen_visitor(const char*);
+    codegen_visitor(const char*, const codegen_options&);
     ~codegen_visitor();
 
-    void initialize();
-    void terminate();
+    int initialize();
+    int terminate(); // 1 if the object could not be written
+
+    // Make a function known without emitting it; it is declared in the
+    // module on its first reference.
+    void declare(function_declaration_node*);
+
+    // Optimize the module and emit it to memory instead of <source>.o;
+    // as bitcode for lto_prelink
+    int emit(std::string& object_code, std::string* ir_text);
+
+    // Merge a module given as bitcode into this one (lto_link). The
+    // result is internalized and optimized by terminate().
+    int link(const std::string& bitcode, const char* name);
 
     virtual int visit(top_level_node*);
     virtual int visit(number_node*);
@@ -25,10 +78,14 @@ public:
     virtual int visit(function_definition_node*);
     virtual int visit(block_node*);
     virtual int visit(assignment_node*);
+    virtual int visit(index_node*);
     virtual int visit(if_else_node*);
     virtual int visit(for_loop_node*);
 
 protected:
+    int visit_short_circuit(binary_expression_node*);
+    int visit_select(if_else_node*);
+
     codegen_impl* impl {nullptr};
 };
 
@@ -0,0 +1,227 @@
+#include "compiler_instance.hh"
+#include "ast_file.hh"
+#include "utility.hh"
+#include "trace.hh"
+#include "kal.parser.gen.hh"
+
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// The reentrant scanner generated by flex
+typedef void* yyscan_t;
+struct yy_buffer_state;
+extern int yylex_init_extra(compiler_instance*, yyscan_t*);
+extern int yylex_destroy(yyscan_t);
+extern void yyrestart(FILE*, yyscan_t);
+extern yy_buffer_state* yy_scan_buffer(char*, size_t, yyscan_t);
+extern void yy_delete_buffer(yy_buffer_state*, yyscan_t);
+extern void yyset_lineno(int, yyscan_t);
+extern void yyset_column(int, yyscan_t);
+extern int yyget_lineno(yyscan_t);
+extern int yyget_column(yyscan_t);
+extern char* yyget_text(yyscan_t);
+extern int yylex(YYSTYPE*, yyscan_t);
+
+
+static thread_local compiler_instance* __current_instance = nullptr;
+
+compiler_instance* current_instance()
+{
+    return __current_instance;
+}
+
+instance_scope::instance_scope(compiler_instance* instance)
+{
+    previous = __current_instance;
+    __current_instance = instance;
+    set_ast_arena(instance ? &instance->ast_arena : nullptr);
+}
+
+instance_scope::~instance_scope()
+{
+    __current_instance = previous;
+    set_ast_arena(previous ? &previous->ast_arena : nullptr);
+}
+
+
+compiler_instance::compiler_instance()
+{
+    yylex_init_extra(this, &scanner); // the lexer asks whether the input is mapped
+}
+
+compiler_instance::~compiler_instance()
+{
+    close();
+    yylex_destroy(scanner);
+}
+
+
+int compiler_instance::open(const char* filename)
+{
+    trace_scope scope("frontend", "map source");
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0)
+    {
+        if (fd >= 0) ::close(fd);
+        fprintf(diagnostic_stream(), "[ERROR] Cannot open file \"%s\".\n", filename);
+        return 1;
+    }
+
+    // flex keeps the size of a buffer in an int.
+    if (S_ISREG(status.st_mode) && status.st_size < INT_MAX - 2)
+    {
+        // The file is mapped over zeroed pages, so the two null bytes that
+        // must follow the text are there even when it fills its last page.
+        // The mapping is private and writable: flex null-terminates every
+        // token in place for a moment.
+        size_t size = status.st_size;
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t reserved = (size + 2 + page - 1) / page * page;
+        void* base = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED && size > 0 &&
+            mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            munmap(base, reserved);
+            base = MAP_FAILED;
+        }
+        if (base != MAP_FAILED)
+        {
+            ::close(fd); // the mapping stays
+            if (size > 0) madvise(base, size, MADV_SEQUENTIAL);
+            mapping = (char*)base;
+            mapping_size = size;
+            return 0;
+        }
+    }
+
+    stream = fdopen(fd, "r");
+    if (!stream)
+    {
+        ::close(fd);
+        fprintf(diagnostic_stream(), "[ERROR] Cannot open file \"%s\".\n", filename);
+        return 1;
+    }
+    owns_stream = true;
+    return 0;
+}
+
+void compiler_instance::open(FILE* fd)
+{
+    close();
+    stream = fd;
+}
+
+void compiler_instance::close()
+{
+    if (buffer)
+    {
+        yy_delete_buffer((yy_buffer_state*)buffer, scanner);
+        buffer = nullptr;
+    }
+    if (mapping)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        munmap(mapping, (mapping_size + 2 + page - 1) / page * page);
+        mapping = nullptr;
+        mapping_size = 0;
+    }
+    if (stream && owns_stream)
+        fclose(stream);
+    stream = nullptr;
+    owns_stream = false;
+}
+
+void compiler_instance::rewind()
+{
+    simd_active = lexer == lexer_simd && mapping;
+    if (simd_active)
+    {
+        simd.reset(mapping, mapping_size);
+        return;
+    }
+
+    if (mapping)
+    {
+        if (buffer) yy_delete_buffer((yy_buffer_state*)buffer, scanner);
+        buffer = yy_scan_buffer(mapping, mapping_size + 2, scanner);
+    }
+    else
+    {
+        yyrestart(stream, scanner); // the scanner may hold the end of the previous input
+    }
+    yyset_lineno(1, scanner);
+    yyset_column(1, scanner);
+}
+
+
+int compiler_instance::parse()
+{
+    instance_scope scope(this);
+    rewind();
+    lex_time = token_count = 0;
+    return yyparse(this);
+}
+
+int compiler_instance::parse_file(const char* filename, ast_file_reader& reader)
+{
+    size_t length = strlen(filename);
+    if (length > 5 && strcmp(filename + length - 5, ".kast") == 0)
+        return reader.open(filename) != 0 || reader.run(*this) != 0;
+
+    if (open(filename) != 0)
+        return 1;
+    return parse();
+}
+
+void compiler_instance::lex()
+{
+    instance_scope scope(this);
+    rewind();
+
+    YYSTYPE value;
+    while (next_token(&value) != 0);
+}
+
+int compiler_instance::next_token(YYSTYPE* value)
+{
+    return simd_active ? simd.next(value) : yylex(value, scanner);
+}
+
+void compiler_instance::hand_over()
+{
+    if (the_folder)
+        root.accept(the_folder); // simplify the command first
+
+    if (root.accept(the_visitor) != 0)
+        ++errors; // reported, the command is dropped
+    root.content = nullptr;
+    if (!the_visitor->retains_ast())
+    {
+        trace_scope scope("frontend", "free AST");
+        ast_arena.reset(); // the whole tree of the command goes at once
+    }
+}
+
+int compiler_instance::line()
+{
+    return simd_active ? simd.line() : yyget_lineno(scanner);
+}
+
+int compiler_instance::column()
+{
+    return simd_active ? simd.column() : yyget_column(scanner);
+}
+
+std::string compiler_instance::token_text()
+{
+    return simd_active ? simd.text() : std::string(yyget_text(scanner));
+}
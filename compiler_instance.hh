@@ -0,0 +1,119 @@
+#ifndef KS_COMPILER_INSTANCE_HH
+#define KS_COMPILER_INSTANCE_HH
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "arena.hh"
+#include "simd_lexer.hh"
+#include "visitor.hh"
+
+
+class ast_file_reader;
+
+
+enum lexer_kind
+{
+    lexer_flex, // the scanner generated from kaleidoscope.l
+    lexer_simd, // simd_lexer, for mapped sources; streams still go to flex
+};
+
+// What the command line chooses for every source a front end reads
+struct frontend_options
+{
+    bool fold {true}; // -fno-fold
+    lexer_kind lexer {lexer_flex}; // --lexer=
+};
+
+
+// The state of one front end: the reentrant scanner and its position, the
+// command being parsed, the visitors the commands are handed to and the
+// arena holding their AST. Instances share nothing but the symbol table,
+// so sources can be parsed on several threads at once.
+struct compiler_instance
+{
+    compiler_instance();
+    ~compiler_instance();
+
+    compiler_instance(const compiler_instance&) = delete;
+    compiler_instance& operator=(const compiler_instance&) = delete;
+
+    // Take the input from a file. A regular file is mapped and scanned in
+    // place, without copying its text: the lexemes of the numbers point
+    // into the mapping, which stays until the next open() or the end of
+    // the instance. Anything else, such as a pipe, is read as a stream.
+    int open(const char* filename);
+    void open(FILE*); // left open, e.g. stdin
+    void close();
+
+    // Parse the input, handing its commands over one by one; 1 on a
+    // syntax error that stopped the parser
+    int parse();
+
+    // Only read the tokens of the input (--stop-after=lex)
+    void lex();
+
+    // The next token for the parser, from the lexer in use
+    int next_token(YYSTYPE*);
+
+    // Open a source and parse it, or load it if it is a .kast file; the
+    // lexemes of the numbers then live as long as the reader.
+    int parse_file(const char* filename, ast_file_reader&);
+
+    // Give the command in root to the folder and the visitor, then release
+    // its AST unless the visitor keeps it
+    void hand_over();
+
+    // Position of the scanner, stamped on the nodes made
+    int line();
+    int column();
+    std::string token_text(); // of the last token, for syntax errors
+
+    visitor* the_visitor {nullptr};
+    visitor* the_folder {nullptr}; // rewrites every command first (none if null)
+
+    void* scanner {nullptr}; // yyscan_t
+    lexer_kind lexer {lexer_flex};
+    simd_lexer simd;
+    bool simd_active {}; // the input is mapped and lexer is lexer_simd
+
+    char* mapping {nullptr};  // the file followed by the two null bytes flex ends a buffer with
+    size_t mapping_size {};   // of the file
+    void* buffer {nullptr};   // YY_BUFFER_STATE over the mapping
+    FILE* stream {nullptr};   // when the input is not mapped
+    bool owns_stream {};
+
+    top_level_node root;     // the command being parsed
+    arena ast_arena;
+    int errors {}; // commands the visitor failed on
+
+    // Lexing happens inside the parser; with --trace its time is summed per command.
+    uint64_t parse_start {};
+    uint64_t lex_time {};
+    uint64_t token_count {};
+
+protected:
+    void rewind(); // scan the input from its start
+};
+
+
+// Makes an instance the one of the calling thread while it lives: nodes are
+// allocated from its arena and take the position of its scanner.
+class instance_scope
+{
+public:
+    explicit instance_scope(compiler_instance*);
+    ~instance_scope();
+
+    instance_scope(const instance_scope&) = delete;
+    instance_scope& operator=(const instance_scope&) = delete;
+
+protected:
+    compiler_instance* previous;
+};
+
+// The instance active on the calling thread, if any
+compiler_instance* current_instance();
+
+
+#endif // KS_COMPILER_INSTANCE_HH
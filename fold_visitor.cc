@@ -0,0 +1,272 @@
+#include "fold_visitor.hh"
+#include "ast_probe.hh"
+#include "arena.hh"
+
+#include <cmath>
+
+
+// Whether a subtree assigns a variable not known yet. Code that does cannot
+// be dropped: the variable is known to the rest of the function from there on.
+static bool assigns_unknown(ast_node* node, const std::vector<bool>& known)
+{
+    effect_probe probe(node);
+    for (int variable : probe.assigned)
+        if ((size_t)variable >= known.size() || !known[variable])
+            return true;
+    return false;
+}
+
+// Literal value of a node, if it is one
+static bool is_number(ast_node* node, double& value)
+{
+    node_probe probe(node);
+    if (!probe.number) return false;
+    value = probe.number->number;
+    return true;
+}
+
+// Condition test of the generated code (fcmp one 0.0): NaN is false
+static bool is_true(double value)
+{
+    return value != 0.0 && !std::isnan(value);
+}
+
+// An operation on two literals, computed as the generated code would
+static bool evaluate(char operation, double lhs, double rhs, double& value)
+{
+    switch (operation)
+    {
+    case '+': value = lhs + rhs; return true;
+    case '-': value = lhs - rhs; return true;
+    case '*': value = lhs * rhs; return true;
+    case '/': value = lhs / rhs; return true;
+    case '<': value = !(lhs >= rhs); return true; // fcmp ult, true if unordered
+    case '>': value = !(lhs <= rhs); return true; // fcmp ugt
+    case '|': value = is_true(lhs) || is_true(rhs); return true;
+    case '&': value = is_true(lhs) && is_true(rhs); return true;
+    default: return false; // reported by the code generation
+    }
+}
+
+// Whether the condition of a loop is false on entry: a literal false, or a
+// comparison of the variable the loop initializes to a literal against
+// another literal, e.g. "for i = 0, i < 0, ...".
+static bool never_runs(for_loop_node* node)
+{
+    double value;
+    if (is_number(node->cond, value))
+        return !is_true(value);
+
+    node_probe init(node->init);
+    node_probe cond(node->cond);
+    double start;
+    if (!init.assignment || !cond.binary || !is_number(init.assignment->expression, start))
+        return false;
+
+    node_probe lhs(cond.binary->lhs);
+    node_probe rhs(cond.binary->rhs);
+    int variable = init.assignment->variable;
+    if (lhs.variable && lhs.variable->name == variable && rhs.number)
+        return evaluate(cond.binary->operation, start, rhs.number->number, value) && !is_true(value);
+    if (rhs.variable && rhs.variable->name == variable && lhs.number)
+        return evaluate(cond.binary->operation, lhs.number->number, start, value) && !is_true(value);
+    return false;
+}
+
+static ast_node* make_number_at(double value, ast_node* where)
+{
+    number_node* node = make_number_node(value);
+    node->row = where->row;
+    node->col = where->col;
+    return node;
+}
+
+
+bool fold_visitor::is_array(ast_node* node)
+{
+    node_probe probe(node);
+    return probe.variable && (size_t)probe.variable->name < arrays.size() && arrays[probe.variable->name];
+}
+
+ast_node* fold_visitor::fold(ast_node* node)
+{
+    result = node;
+    node->accept(this);
+    return result;
+}
+
+int fold_visitor::visit(top_level_node* node)
+{
+    if (node->content) node->content = fold(node->content);
+    return 0;
+}
+
+int fold_visitor::visit(number_node* node)
+{
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(variable_node* node)
+{
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(binary_expression_node* node)
+{
+    node->lhs = fold(node->lhs);
+
+    // The right operand of & and | is not evaluated when the left one
+    // decides the value.
+    double decided;
+    if ((node->operation == '&' || node->operation == '|') && is_number(node->lhs, decided) &&
+        is_true(decided) == (node->operation == '|') && !assigns_unknown(node->rhs, known))
+    {
+        result = make_number_at(is_true(decided) ? 1.0 : 0.0, node);
+        folded_count += 2;
+        return 0;
+    }
+
+    node->rhs = fold(node->rhs);
+    result = node;
+
+    double lhs, rhs;
+    bool lhs_number = is_number(node->lhs, lhs);
+    bool rhs_number = is_number(node->rhs, rhs);
+
+    double value;
+    if (lhs_number && rhs_number && evaluate(node->operation, lhs, rhs, value))
+    {
+        result = make_number_at(value, node);
+        folded_count += 2;
+        return 0;
+    }
+
+    // Identities exact in IEEE arithmetic for every x, -0 and NaN included.
+    // x+0 is not one (-0+0 is +0), neither is x*0. An array times 1 stays an
+    // error for the code generation to report.
+    if (is_array(node->lhs) || is_array(node->rhs))
+        return 0;
+
+    if ((rhs_number && rhs == 1.0 && (node->operation == '*' || node->operation == '/')) ||
+        (rhs_number && rhs == 0.0 && !std::signbit(rhs) && node->operation == '-'))
+    {
+        result = node->lhs;
+        ++folded_count;
+    }
+    else if (lhs_number && lhs == 1.0 && node->operation == '*')
+    {
+        result = node->rhs;
+        ++folded_count;
+    }
+
+    return 0;
+}
+
+int fold_visitor::visit(call_function_node* node)
+{
+    for (ast_node*& child : *node->arguments)
+        child = fold(child);
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(function_declaration_node* node)
+{
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(function_definition_node* node)
+{
+    known.assign(known.size(), false);
+    arrays.assign(arrays.size(), false);
+    for (variable_node* argument : *node->declaration->arguments)
+    {
+        if (known.size() <= (size_t)argument->name) known.resize(argument->name + 1);
+        known[argument->name] = true;
+        if (arrays.size() <= (size_t)argument->name) arrays.resize(argument->name + 1);
+        arrays[argument->name] = argument->is_array;
+    }
+
+    node->definition = fold(node->definition);
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(block_node* node)
+{
+    for (ast_node*& child : *node->expressions)
+        child = fold(child);
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(assignment_node* node)
+{
+    node->expression = fold(node->expression);
+    if (known.size() <= (size_t)node->variable) known.resize(node->variable + 1);
+    known[node->variable] = true;
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(index_node* node)
+{
+    node->index = fold(node->index);
+    if (node->value) node->value = fold(node->value);
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(if_else_node* node)
+{
+    node->condition = fold(node->condition);
+    result = node;
+
+    // Only the branch taken is kept; the condition has no side effect.
+    double condition;
+    if (is_number(node->condition, condition))
+    {
+        bool taken = is_true(condition);
+        if (!assigns_unknown(taken ? node->else_expr : node->then_expr, known))
+        {
+            result = fold(taken ? node->then_expr : node->else_expr);
+            folded_count += 2;
+            return 0;
+        }
+    }
+
+    node->then_expr = fold(node->then_expr);
+    node->else_expr = fold(node->else_expr);
+    result = node;
+    return 0;
+}
+
+int fold_visitor::visit(for_loop_node* node)
+{
+    node->init = fold(node->init);
+    node->cond = fold(node->cond);
+    result = node;
+
+    if (never_runs(node) && !assigns_unknown(node->step, known) && !assigns_unknown(node->expr, known))
+    {
+        // Keep the initialization for its side effects; a loop that did not
+        // run evaluates to 0.
+        auto* expressions = make_small_vector<ast_node*>(get_ast_arena());
+        expressions->push_back(node->init);
+        expressions->push_back(make_number_at(0.0, node));
+        block_node* block = make_block_node(expressions);
+        block->row = node->row;
+        block->col = node->col;
+        result = block;
+        folded_count += 2;
+        return 0;
+    }
+
+    node->step = fold(node->step);
+    node->expr = fold(node->expr);
+    result = node;
+    return 0;
+}
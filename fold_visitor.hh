@@ -0,0 +1,40 @@
+#ifndef KS_FOLD_VISITOR_HH
+#define KS_FOLD_VISITOR_HH
+
+#include <vector>
+#include "visitor.hh"
+
+
+// Simplifies a command in place before code generation: arithmetic on
+// literals is computed, branches on a literal condition are chosen and
+// loops that cannot run are dropped. Every rewrite gives the same value
+// the generated code would, so it is safe at any optimization level.
+class fold_visitor : public visitor
+{
+public:
+    virtual int visit(top_level_node*);
+    virtual int visit(number_node*);
+    virtual int visit(variable_node*);
+    virtual int visit(binary_expression_node*);
+    virtual int visit(call_function_node*);
+    virtual int visit(function_declaration_node*);
+    virtual int visit(function_definition_node*);
+    virtual int visit(block_node*);
+    virtual int visit(assignment_node*);
+    virtual int visit(index_node*);
+    virtual int visit(if_else_node*);
+    virtual int visit(for_loop_node*);
+
+    int folded_count {}; // nodes removed so far
+
+protected:
+    // Visit a child and return what replaces it
+    ast_node* fold(ast_node*);
+    bool is_array(ast_node*);
+
+    ast_node* result {nullptr};
+    std::vector<bool> known;  // variables of the function assigned so far, by symbol id
+    std::vector<bool> arrays; // array parameters of the function, by symbol id
+};
+
+#endif // KS_FOLD_VISITOR_HH
@@ -0,0 +1,144 @@
+#include "hash_visitor.hh"
+#include "symbol_table.hh"
+#include <cstring>
+#include <string>
+
+
+hash_visitor::hash_visitor(const std::vector<std::string>* signatures, bool with_locations)
+{
+    this->signatures = signatures;
+    this->with_locations = with_locations;
+}
+
+void hash_visitor::add_node(char tag, ast_node* node)
+{
+    buffer += tag;
+    if (with_locations)
+    {
+        buffer += std::to_string(node->row);
+        buffer += ':';
+        buffer += std::to_string(node->col);
+    }
+    buffer += ' ';
+}
+
+void hash_visitor::add_symbol(int symbol)
+{
+    // names may hold any identifier character, so prefix them with their length
+    const char* name = symbol_name(symbol);
+    buffer += std::to_string(strlen(name));
+    buffer += ':';
+    buffer += name;
+    buffer += ' ';
+}
+
+int hash_visitor::visit(top_level_node* node)
+{
+    if (!node->content) return 0;
+    return node->content->accept(this);
+}
+
+int hash_visitor::visit(number_node* node)
+{
+    add_node('n', node);
+    buffer.append(node->value, node->length);
+    buffer += ' ';
+    return 0;
+}
+
+int hash_visitor::visit(variable_node* node)
+{
+    add_node('v', node);
+    add_symbol(node->name);
+    if (node->is_array) buffer += "[] ";
+    return 0;
+}
+
+int hash_visitor::visit(binary_expression_node* node)
+{
+    add_node('b', node);
+    buffer += node->operation;
+    node->lhs->accept(this);
+    node->rhs->accept(this);
+    return 0;
+}
+
+int hash_visitor::visit(call_function_node* node)
+{
+    add_node('c', node);
+    add_symbol(node->callee);
+    if (signatures && (size_t)node->callee < signatures->size())
+        buffer += (*signatures)[node->callee];
+    buffer += ' ';
+    buffer += std::to_string(node->arguments->size());
+    buffer += ' ';
+    for (ast_node* child : *node->arguments)
+        child->accept(this);
+    return 0;
+}
+
+int hash_visitor::visit(function_declaration_node* node)
+{
+    add_node('d', node);
+    add_symbol(node->name);
+    buffer += std::to_string(node->arguments->size());
+    buffer += ' ';
+    for (variable_node* child : *node->arguments)
+        child->accept(this);
+    return 0;
+}
+
+int hash_visitor::visit(function_definition_node* node)
+{
+    add_node('f', node);
+    node->declaration->accept(this);
+    node->definition->accept(this);
+    return 0;
+}
+
+int hash_visitor::visit(block_node* node)
+{
+    add_node('k', node);
+    buffer += std::to_string(node->expressions->size());
+    buffer += ' ';
+    for (ast_node* child : *node->expressions)
+        child->accept(this);
+    return 0;
+}
+
+int hash_visitor::visit(assignment_node* node)
+{
+    add_node('a', node);
+    add_symbol(node->variable);
+    node->expression->accept(this);
+    return 0;
+}
+
+int hash_visitor::visit(index_node* node)
+{
+    add_node('x', node);
+    add_symbol(node->array);
+    buffer += node->value ? "1 " : "0 ";
+    node->index->accept(this);
+    if (node->value) node->value->accept(this);
+    return 0;
+}
+
+int hash_visitor::visit(if_else_node* node)
+{
+    add_node('i', node);
+    node->condition->accept(this);
+    node->then_expr->accept(this);
+    node->else_expr->accept(this);
+    return 0;
+}
+
+int hash_visitor::visit(for_loop_node* node)
+{
+    add_node('l', node);
+    node->init->accept(this);
+    node->cond->accept(this);
+    node->step->accept(this);
+    node->expr->accept(this);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef KS_HASH_VISITOR_HH
+#define KS_HASH_VISITOR_HH
+
+#include <string>
+#include <vector>
+#include "visitor.hh"
+
+
+// Writes a canonical description of the visited commands into a string, the
+// input of the compilation cache key. A call records the signature of the
+// callee known at that point, since it shapes the declaration emitted.
+class hash_visitor : public visitor
+{
+public:
+    hash_visitor(const std::vector<std::string>* signatures, bool with_locations);
+
+    std::string& text() { return buffer; }
+
+    virtual int visit(top_level_node*);
+    virtual int visit(number_node*);
+    virtual int visit(variable_node*);
+    virtual int visit(binary_expression_node*);
+    virtual int visit(call_function_node*);
+    virtual int visit(function_declaration_node*);
+    virtual int visit(function_definition_node*);
+    virtual int visit(block_node*);
+    virtual int visit(assignment_node*);
+    virtual int visit(index_node*);
+    virtual int visit(if_else_node*);
+    virtual int visit(for_loop_node*);
+
+protected:
+    void add_node(char, ast_node*);
+    void add_symbol(int);
+
+    std::string buffer;
+    const std::vector<std::string>* signatures {nullptr}; // by symbol id, empty if undeclared
+    bool with_locations {};                               // debug info depends on rows and columns
+};
+
+#endif // KS_HASH_VISITOR_HH
@@ -1,21 +1,47 @@
 %define parse.error verbose
 %define api.token.prefix {}
+%define api.pure full
+%parse-param {compiler_instance* instance}
+%lex-param {compiler_instance* instance}
 
 %code requires // *.hh
 {
 #include "ast_node.hh"
+struct compiler_instance;
+
+// A NUMBER: where its lexeme is and the value the lexer decoded
+struct number_token
+{
+  const char* lexeme;
+  unsigned length;
+  double value;
+};
 }
 
 %code // *.cc
 {
 #include <cstdio>
 #include "utility.hh"
+#include "symbol_table.hh"
 #include "visitor.hh"
+#include "compiler_instance.hh"
 #include "kal.parser.gen.hh"
-#include "dealloc_visitor.hh"
-int yylex ();
-void yyerror (char const *);
-static top_level_node root;
+#include "arena.hh"
+#include "trace.hh"
+void yyerror (compiler_instance*, char const *);
+
+// The lexer of the instance, timed per command with --trace
+static int yylex_traced (YYSTYPE* value, compiler_instance* instance)
+{
+  if (!trace_enabled()) return instance->next_token(value);
+  uint64_t start = trace_now();
+  if (instance->token_count == 0) instance->parse_start = start; // first token of a command
+  int token = instance->next_token(value);
+  instance->lex_time += trace_now() - start;
+  ++instance->token_count;
+  return token;
+}
+#define yylex yylex_traced
 }
 
 %token EXTERN "extern"
@@ -28,19 +54,23 @@ static top_level_node root;
 %union {
   ast_node* node;
   const char* str;
+  number_token number;
+  int sym;
+  variable_node* var;
   function_declaration_node* decl;
-  double_linked_list_node<ast_node*>* nlist;
-  double_linked_list_node<variable_node*>* vlist;
+  small_vector<ast_node*>* nlist;
+  small_vector<variable_node*>* vlist;
 }
 
-%token <str> NUMBER
-%token <str> SYMBOL
+%token <number> NUMBER
+%token <sym> SYMBOL
 %token <str> ERROR
 
 %type <node> expression
 %type <decl> declaration
 %type <nlist> expressions
 %type <vlist> arguments
+%type <var> argument
 
 %right  '='
 %left   '|'
@@ -55,8 +85,15 @@ static top_level_node root;
 
 program: program command
   {
-    root.accept(get_the_visitor());
-    root.accept(get_dealloc_visitor());
+    if (trace_enabled())
+    {
+      char args[64];
+      snprintf(args, sizeof(args), "\"lex_us\": %llu, \"tokens\": %llu", (unsigned long long)instance->lex_time, (unsigned long long)instance->token_count);
+      trace_event("frontend", "parse", nullptr, instance->parse_start, trace_now(), args);
+    }
+
+    instance->hand_over();
+    instance->lex_time = instance->token_count = 0;
   }
   | /* empty */
   {
@@ -66,19 +103,20 @@ program: program command
 
 command: EXTERN declaration ';'
   {
-    root.content = $2;
+    instance->root.content = $2;
   }
   | DEFINE declaration expression ';'
   {
-    root.content = make_function_definition_node($2, $3);
+    instance->root.content = make_function_definition_node($2, $3);
   }
   | expression ';' /* anonymous expression */
   {
-    root.content = make_function_definition_node(make_function_declaration_node("", nullptr), $1);
+    instance->root.content = make_function_definition_node(make_function_declaration_node(empty_symbol, make_small_vector<variable_node*>(get_ast_arena())), $1);
   }
   | ERROR ';'
   {
-    yyerror($1);
+    yyerror(instance, $1);
+    ++instance->errors; // the command is dropped
     yyerrok;
   }
   ;
@@ -89,17 +127,27 @@ declaration: SYMBOL '(' arguments ')'
   }
   ;
 
-arguments: arguments ',' SYMBOL
+arguments: arguments ',' argument
   {
-    $$ = $1; append($$, make_variable_node($3));
+    $$ = $1; $$->push_back($3);
   }
-  | SYMBOL
+  | argument
   {
-    $$ = make_double_linked_list_node<variable_node*>(make_variable_node($1));
+    $$ = make_small_vector<variable_node*>(get_ast_arena()); $$->push_back($1);
   }
   | /* empty */
   {
-    $$ = nullptr;
+    $$ = make_small_vector<variable_node*>(get_ast_arena());
+  }
+  ;
+
+argument: SYMBOL
+  {
+    $$ = make_variable_node($1);
+  }
+  | SYMBOL '[' ']'
+  {
+    $$ = make_variable_node($1); $$->is_array = true;
   }
   ;
 
@@ -149,7 +197,7 @@ expression: '(' expression ')'
   }
   | NUMBER
   {
-    $$ = make_number_node($1);
+    $$ = make_number_node($1.lexeme, $1.length, $1.value);
   }
   | '{' expressions '}'
   {
@@ -159,6 +207,14 @@ expression: '(' expression ')'
   {
     $$ = make_assignment_node($1, $3);
   }
+  | SYMBOL '[' expression ']'
+  {
+    $$ = make_index_node($1, $3, nullptr);
+  }
+  | SYMBOL '[' expression ']' '=' expression
+  {
+    $$ = make_index_node($1, $3, $6);
+  }
   | IF expression THEN expression ELSE expression
   {
     $$ = make_if_else_node($2, $4, $6);
@@ -171,24 +227,22 @@ expression: '(' expression ')'
 
 expressions: expressions ',' expression
   {
-    $$ = $1; append($$, $3);
+    $$ = $1; $$->push_back($3);
   }
   | expression
   {
-    $$ = make_double_linked_list_node<ast_node*>($1);
+    $$ = make_small_vector<ast_node*>(get_ast_arena()); $$->push_back($1);
   }
   | /* empty */
   {
-    $$ = nullptr;
+    $$ = make_small_vector<ast_node*>(get_ast_arena());
   }
   ;
 
 %%
 
-void yyerror(const char *errmsg)
+
+void yyerror(compiler_instance* instance, const char *errmsg)
 {
-  extern int yylineno;
-  extern int yycolumn;
-  extern char* yytext;
-  fprintf(stderr, "[ERROR] Token \"%s\" at/near (%d, %d): %s\n", yytext, yylineno, yycolumn, errmsg);
+  fprintf(diagnostic_stream(), "[ERROR] Token \"%s\" at/near (%d, %d): %s\n", instance->token_text().c_str(), instance->line(), instance->column(), errmsg);
 }
\ No newline at end of file
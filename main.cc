@@ -2,46 +2,630 @@
 #include "visitor.hh"
 #include "print_json_visitor.hh"
 #include "codegen_visitor.hh"
+#include "fold_visitor.hh"
+#include "parallel_codegen_visitor.hh"
+#include "batch_compiler.hh"
+#include "compiler_instance.hh"
+#include "object_cache.hh"
+#include "ast_file.hh"
+#include "trace.hh"
+#include "utility.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+static void print_usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [options] [source...]\n", program);
+    fprintf(stderr, "  A source named *.kast is an AST written by --emit-ast, loaded without parsing.\n");
+    fprintf(stderr, "  Several sources, or *.bc files written by --emit-bc, are linked into the object given by -o.\n");
+    fprintf(stderr, "  --run        compile with the JIT and execute top-level expressions\n");
+    fprintf(stderr, "  -O0 .. -O3   optimization level (default -O0)\n");
+    fprintf(stderr, "  -g           emit debug info\n");
+    fprintf(stderr, "  -march=native, -mcpu=<cpu>\n");
+    fprintf(stderr, "               CPU to optimize for and generate code for (default generic)\n");
+    fprintf(stderr, "  -mattr=<+f,-g,...>\n");
+    fprintf(stderr, "               enable/disable target features\n");
+    fprintf(stderr, "  -ffp-contract=fast\n");
+    fprintf(stderr, "               allow fusing multiply-add into FMA\n");
+    fprintf(stderr, "  -ftail-accumulate\n");
+    fprintf(stderr, "               turn x + f(...) and x * f(...) returned by f into a loop (reassociates)\n");
+    fprintf(stderr, "  -fno-fold    do not fold constants in the AST\n");
+    fprintf(stderr, "  --lexer=<flex|simd>\n");
+    fprintf(stderr, "               scanner of the source files (default flex); simd is hand-written with SSE2/AVX2\n");
+    fprintf(stderr, "  --no-ir      do not print the IR\n");
+    fprintf(stderr, "  --no-object  do not write the object file\n");
+    fprintf(stderr, "  -o <file>    name of the object file (default <source>.o)\n");
+    fprintf(stderr, "  --emit-bc    write <source>.bc for a later link instead of an object\n");
+    fprintf(stderr, "  --export=<f,g,...>\n");
+    fprintf(stderr, "               functions a link keeps external, the others may be inlined and dropped\n");
+    fprintf(stderr, "  --emit-json=<file>\n");
+    fprintf(stderr, "               write the AST as JSON to <file> (- for stdout) instead of compiling\n");
+    fprintf(stderr, "  --json-compact\n");
+    fprintf(stderr, "               write the JSON without whitespace\n");
+    fprintf(stderr, "  --emit-ast=<file.kast>\n");
+    fprintf(stderr, "               write the parsed AST in binary to <file.kast> instead of compiling\n");
+    fprintf(stderr, "  --threads=<n>\n");
+    fprintf(stderr, "               compile the functions of a source file on n threads\n");
+    fprintf(stderr, "  -j <n>       compile each source into its own <source>.o (or .bc), n sources at a time\n");
+    fprintf(stderr, "  --stop-after=<lex|parse|codegen|optimize>\n");
+    fprintf(stderr, "               stop after a phase of the compilation, for benchmarking\n");
+    fprintf(stderr, "  --trace=<file>\n");
+    fprintf(stderr, "               write a Chrome trace-event timeline of the compiler phases\n");
+    fprintf(stderr, "  --cache-dir=<dir>\n");
+    fprintf(stderr, "               reuse the object code of unchanged functions from <dir>\n");
+    fprintf(stderr, "  --cache-size=<MiB>\n");
+    fprintf(stderr, "               evict the least recently used entries beyond this size (default 512)\n");
+}
+
+
+static bool has_extension(const char* filename, const char* extension)
+{
+    size_t length = strlen(filename), extension_length = strlen(extension);
+    return length > extension_length && strcmp(filename + length - extension_length, extension) == 0;
+}
+
+static int read_file(const char* filename, std::string& content)
+{
+    FILE* fd = fopen(filename, "rb");
+    if (!fd)
+    {
+        fprintf(stderr, "[ERROR] Cannot open file \"%s\".\n", filename);
+        return 1;
+    }
+    char buffer[65536];
+    size_t n;
+    content.clear();
+    while ((n = fread(buffer, 1, sizeof(buffer), fd)) > 0)
+        content.append(buffer, n);
+    int status = ferror(fd) ? 1 : 0;
+    fclose(fd);
+    if (status) fprintf(stderr, "[ERROR] Cannot read file \"%s\".\n", filename);
+    return status;
+}
+
+static int write_file(const std::string& filename, const std::string& content)
+{
+    FILE* fd = fopen(filename.c_str(), "wb");
+    if (!fd)
+    {
+        fprintf(stderr, "[ERROR] Cannot open file \"%s\".\n", filename.c_str());
+        return 1;
+    }
+    bool written = fwrite(content.data(), 1, content.size(), fd) == content.size();
+    if (fclose(fd) != 0 || !written)
+    {
+        fprintf(stderr, "[ERROR] Cannot write file \"%s\".\n", filename.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+// Compile one source into bitcode in memory, one module of a link
+static int compile_to_bitcode(const char* source_filename, const codegen_options& options, const frontend_options& frontend, std::string& bitcode, std::string* ir_text)
+{
+    codegen_visitor the_visitor(source_filename, options);
+    if (the_visitor.initialize() != 0)
+        return 1;
+
+    compiler_instance instance;
+    fold_visitor the_folder;
+    instance.the_visitor = &the_visitor;
+    if (frontend.fold) instance.the_folder = &the_folder;
+    instance.lexer = frontend.lexer;
+
+    ast_file_reader reader;
+    if (instance.parse_file(source_filename, reader) != 0 || instance.errors != 0)
+        return 1;
+    return the_visitor.emit(bitcode, ir_text);
+}
+
+// --emit-bc: each source into <source>.bc
+static int write_bitcode(const std::vector<const char*>& sources, codegen_options options, const frontend_options& frontend)
+{
+    options.lto = lto_prelink;
+    int status = 0;
+
+    for (const char* source : sources)
+    {
+        std::string bitcode, ir_text;
+        if (compile_to_bitcode(source, options, frontend, bitcode, options.emit_ir ? &ir_text : nullptr) != 0)
+        {
+            status = 1;
+            continue;
+        }
+        fwrite(ir_text.data(), 1, ir_text.size(), stdout);
+
+        if (options.emit_object && options.stop_after >= phase_emit)
+            status |= write_file(options.output.empty() ? std::string(source) + ".bc" : options.output, bitcode);
+    }
+
+    return status;
+}
+
+// Several sources (or bitcode files): each is compiled and simplified on its
+// own, then they are linked into one module that is optimized as a whole
+// program, so that functions are inlined across sources, and emitted as one
+// object.
+static int link_sources(const std::vector<const char*>& sources, codegen_options options, const frontend_options& frontend)
+{
+    codegen_options link_options = options;
+    link_options.lto = lto_link;
+    codegen_visitor linker(options.output.c_str(), link_options);
+    if (linker.initialize() != 0)
+        return 1;
+
+    options.lto = lto_prelink;
+    options.emit_ir = false; // the linked program is printed
+    int status = 0;
+
+    for (const char* source : sources)
+    {
+        std::string bitcode;
+        if (has_extension(source, ".bc"))
+            status |= read_file(source, bitcode);
+        else
+            status |= compile_to_bitcode(source, options, frontend, bitcode, nullptr);
+
+        if (status == 0 && options.stop_after >= phase_emit)
+            status |= linker.link(bitcode, source);
+    }
+
+    // Nothing is written when a source failed.
+    if (status == 0 && options.stop_after >= phase_emit)
+        status |= linker.terminate();
+
+    return status;
+}
+
+// -j N: every source into its own object, N at a time
+static int compile_batch(const std::vector<const char*>& sources, codegen_options options, const frontend_options& frontend, bool emit_bitcode, int jobs)
+{
+    if (emit_bitcode) options.lto = lto_prelink;
+    batch_compiler compiler(options, frontend, jobs);
+    if (compiler.initialize() != 0)
+        return 1;
+
+    for (const char* source : sources)
+        compiler.add_source(source);
+    return compiler.run();
+}
 
 
 int main(int argc, char** argv)
 {
-    FILE* fd {};
+    const char* source_filename {};
+    std::vector<const char*> sources;
+    codegen_options options;
+    bool emit_bitcode {};
+    int threads {};
+    int jobs {};
+    const char* cache_dir {};
+    const char* trace_filename {};
+    const char* json_filename {};
+    const char* ast_filename {};
+    bool from_ast {};
+    bool json_compact {};
+    frontend_options frontend;
+    long cache_size_mib {512};
 
-    if (argc < 2)
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--run") == 0)
+        {
+            options.jit = true;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '3' && argv[i][3] == '\0')
+        {
+            options.opt_level = argv[i][2] - '0';
+        }
+        else if (strcmp(argv[i], "-g") == 0)
+        {
+            options.debug_info = true;
+        }
+        else if (strncmp(argv[i], "-march=", 7) == 0)
+        {
+            options.cpu = argv[i] + 7;
+        }
+        else if (strncmp(argv[i], "-mcpu=", 6) == 0)
+        {
+            options.cpu = argv[i] + 6;
+        }
+        else if (strncmp(argv[i], "-mattr=", 7) == 0)
+        {
+            options.features = argv[i] + 7;
+        }
+        else if (strcmp(argv[i], "-ffp-contract=fast") == 0)
+        {
+            options.fp_contract_fast = true;
+        }
+        else if (strcmp(argv[i], "-ftail-accumulate") == 0)
+        {
+            options.tail_accumulate = true;
+        }
+        else if (strcmp(argv[i], "-fno-fold") == 0)
+        {
+            frontend.fold = false;
+        }
+        else if (strncmp(argv[i], "--lexer=", 8) == 0)
+        {
+            const char* kind = argv[i] + 8;
+            if (strcmp(kind, "flex") == 0) frontend.lexer = lexer_flex;
+            else if (strcmp(kind, "simd") == 0) frontend.lexer = lexer_simd;
+            else
+            {
+                fprintf(stderr, "[ERROR] Unknown lexer \"%s\".\n", kind);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--no-ir") == 0)
+        {
+            options.emit_ir = false;
+        }
+        else if (strcmp(argv[i], "--no-object") == 0)
+        {
+            options.emit_object = false;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            options.output = argv[++i];
+        }
+        else if (strcmp(argv[i], "--emit-bc") == 0)
+        {
+            emit_bitcode = true;
+        }
+        else if (strncmp(argv[i], "--export=", 9) == 0)
+        {
+            // comma-separated names
+            for (const char* name = argv[i] + 9; *name; )
+            {
+                const char* comma = strchr(name, ',');
+                size_t length = comma ? comma - name : strlen(name);
+                if (length) options.exports.emplace_back(name, length);
+                name += length + (comma ? 1 : 0);
+            }
+        }
+        else if (strncmp(argv[i], "--emit-json=", 12) == 0)
+        {
+            json_filename = argv[i] + 12;
+        }
+        else if (strncmp(argv[i], "--emit-ast=", 11) == 0)
+        {
+            ast_filename = argv[i] + 11;
+        }
+        else if (strcmp(argv[i], "--json-compact") == 0)
+        {
+            json_compact = true;
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            threads = atoi(argv[i] + 10);
+            if (threads < 1)
+            {
+                fprintf(stderr, "[ERROR] Invalid thread count \"%s\".\n", argv[i] + 10);
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "-j", 2) == 0 && (argv[i][2] || i + 1 < argc))
+        {
+            const char* count = argv[i][2] ? argv[i] + 2 : argv[++i]; // -j N or -jN
+            jobs = atoi(count);
+            if (jobs < 1)
+            {
+                fprintf(stderr, "[ERROR] Invalid job count \"%s\".\n", count);
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "--stop-after=", 13) == 0)
+        {
+            const char* phase = argv[i] + 13;
+            if (strcmp(phase, "lex") == 0) options.stop_after = phase_lex;
+            else if (strcmp(phase, "parse") == 0) options.stop_after = phase_parse;
+            else if (strcmp(phase, "codegen") == 0) options.stop_after = phase_codegen;
+            else if (strcmp(phase, "optimize") == 0) options.stop_after = phase_optimize;
+            else
+            {
+                fprintf(stderr, "[ERROR] Unknown phase \"%s\".\n", phase);
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "--trace=", 8) == 0)
+        {
+            trace_filename = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--cache-dir=", 12) == 0)
+        {
+            cache_dir = argv[i] + 12;
+        }
+        else if (strncmp(argv[i], "--cache-size=", 13) == 0)
+        {
+            cache_size_mib = atol(argv[i] + 13);
+            if (cache_size_mib < 1)
+            {
+                fprintf(stderr, "[ERROR] Invalid cache size \"%s\".\n", argv[i] + 13);
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "[ERROR] Unknown option \"%s\".\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            sources.push_back(argv[i]);
+        }
+    }
+
+    if (!sources.empty())
+        source_filename = sources[0];
+
+    if (jobs > 0)
+    {
+        if (options.jit || !options.output.empty() || threads > 0 || cache_dir || json_filename || ast_filename)
+        {
+            fprintf(stderr, "[ERROR] -j cannot be used with --run, -o, --threads, --cache-dir, --emit-json or --emit-ast.\n");
+            return 1;
+        }
+        if (sources.empty())
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        for (const char* source : sources)
+        {
+            if (has_extension(source, ".bc"))
+            {
+                fprintf(stderr, "[ERROR] \"%s\" is bitcode already.\n", source);
+                return 1;
+            }
+        }
+
+        if (trace_filename && trace_open(trace_filename) != 0)
+            return 1;
+
+        int status = compile_batch(sources, options, frontend, emit_bitcode, jobs);
+
+        trace_close();
+        return status;
+    }
+
+    // Several sources or bitcode make a link.
+    bool link = sources.size() > 1 || (source_filename && has_extension(source_filename, ".bc"));
+    if (link || emit_bitcode)
+    {
+        if (options.jit || threads > 0 || cache_dir || json_filename || ast_filename)
+        {
+            fprintf(stderr, "[ERROR] Linking and --emit-bc cannot be used with --run, --threads, --cache-dir, --emit-json or --emit-ast.\n");
+            return 1;
+        }
+        if (emit_bitcode && sources.empty())
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        for (const char* source : sources)
+        {
+            if (emit_bitcode && has_extension(source, ".bc"))
+            {
+                fprintf(stderr, "[ERROR] \"%s\" is bitcode already.\n", source);
+                return 1;
+            }
+        }
+        if (!options.output.empty() && emit_bitcode && sources.size() > 1)
+        {
+            fprintf(stderr, "[ERROR] -o takes a single source with --emit-bc.\n");
+            return 1;
+        }
+        if (options.output.empty() && !emit_bitcode)
+        {
+            fprintf(stderr, "[ERROR] Name the linked object with -o.\n");
+            return 1;
+        }
+
+        if (trace_filename && trace_open(trace_filename) != 0)
+            return 1;
+
+        int status = emit_bitcode ? write_bitcode(sources, options, frontend) : link_sources(sources, options, frontend);
+
+        trace_close();
+        return status;
+    }
+
+    if ((json_filename || ast_filename) && (options.jit || threads > 0 || cache_dir))
+    {
+        fprintf(stderr, "[ERROR] --emit-json and --emit-ast cannot be used with --run, --threads or --cache-dir.\n");
+        return 1;
+    }
+
+    if (json_filename && ast_filename)
+    {
+        fprintf(stderr, "[ERROR] --emit-json and --emit-ast cannot be used together.\n");
+        return 1;
+    }
+
+    size_t source_length = source_filename ? strlen(source_filename) : 0;
+    from_ast = source_length > 5 && strcmp(source_filename + source_length - 5, ".kast") == 0;
+
+    // the front end; a source file is mapped and lexed in place
+    compiler_instance instance;
+    instance.lexer = frontend.lexer;
+
+    if (!source_filename)
     {
         fprintf(stdout, "[INFO] Entering interactive mode.\n");
-        yyin = stdin;
-        //fprintf(stderr, "Usage: %s [source]\n", argv[0]);
-        //return 1;
+        instance.open(stdin);
+        options.jit = true; // expressions typed in are evaluated right away
     }
-    else
+    else if (!from_ast)
     {
-        fd = fopen(argv[1], "r");
+        if (instance.open(source_filename) != 0)
+            return 1;
+    }
 
-        if (!fd)
+    if ((threads > 0 || cache_dir) && options.jit)
+    {
+        fprintf(stderr, "[ERROR] --threads and --cache-dir cannot be used with the JIT.\n");
+        return 1;
+    }
+
+    // Without a linker to merge the partition objects the source is compiled
+    // as a whole, as it would be without the options.
+    if ((threads > 0 || cache_dir) && options.emit_object && options.stop_after >= phase_emit &&
+        !parallel_codegen_visitor::can_merge_objects())
+    {
+        fprintf(stderr, "[WARNING] Cannot find \"ld\" to merge the objects, --threads and --cache-dir are ignored.\n");
+        threads = 0;
+        cache_dir = nullptr;
+    }
+
+    if (trace_filename && trace_open(trace_filename) != 0)
+        return 1;
+
+    // The mapping holds the lexemes of the numbers until the end.
+    ast_file_reader reader;
+    if (from_ast && reader.open(source_filename) != 0)
+    {
+        trace_close();
+        return 1;
+    }
+    // 1 if the parser stopped or a command was dropped
+    auto parse = [&]()
+    {
+        int status = from_ast ? reader.run(instance) : instance.parse();
+        return status != 0 || instance.errors != 0;
+    };
+
+    // The AST dumps show the source as parsed; a .kast file is folded when loaded.
+    fold_visitor the_folder;
+    if (frontend.fold && !ast_filename && !json_filename) instance.the_folder = &the_folder;
+
+    if (options.stop_after == phase_lex && from_ast)
+    {
+        trace_close(); // mapped and checked, there is nothing to lex
+        return 0;
+    }
+
+    if (options.stop_after == phase_lex)
+    {
+        // read the tokens only
+        {
+            trace_scope scope("frontend", "lex");
+            instance.lex();
+        }
+        trace_close();
+        return 0;
+    }
+
+    if (ast_filename)
+    {
+        ast_writer_visitor the_visitor;
+        the_visitor.initialize(ast_filename);
+        instance.the_visitor = &the_visitor;
+
+        // Nothing is written for a source that did not parse whole.
+        if (parse() != 0)
         {
-            fprintf(stderr, "[ERROR] Cannot open file \"%s\".\n", argv[1]);
+            trace_close();
             return 1;
         }
-        
-        yyin = fd; // set yyin which is used by Lexer
+
+        int status = the_visitor.terminate();
+        trace_close();
+        return status;
     }
 
-    //print_json_visitor the_visitor;
-    codegen_visitor the_visitor(argv[1]);
+    if (json_filename)
+    {
+        FILE* json_fd = strcmp(json_filename, "-") == 0 ? stdout : fopen(json_filename, "wb");
+        if (!json_fd)
+        {
+            fprintf(stderr, "[ERROR] Cannot open file \"%s\".\n", json_filename);
+            trace_close();
+            return 1;
+        }
+
+        print_json_visitor the_visitor;
+        the_visitor.set_output_file_descriptor(json_fd);
+        the_visitor.set_compact(json_compact);
+        the_visitor.initialize();
+        instance.the_visitor = &the_visitor;
+
+        // A source that did not parse whole leaves no JSON file behind.
+        if (parse() != 0)
+        {
+            if (json_fd != stdout)
+            {
+                fclose(json_fd);
+                remove(json_filename);
+            }
+            trace_close();
+            return 1;
+        }
+
+        int status = the_visitor.terminate();
+        if (json_fd != stdout && fclose(json_fd) != 0 && status == 0)
+        {
+            fprintf(stderr, "[ERROR] Cannot write the JSON output.\n");
+            status = 1;
+        }
+        trace_close();
+        return status;
+    }
+
+    if (threads > 0 || cache_dir)
+    {
+        // the cache works on the partitions of the parallel code generation
+        parallel_codegen_visitor the_visitor(source_filename, options, threads);
+        object_cache cache(cache_dir ? cache_dir : "", (uint64_t)cache_size_mib << 20);
+
+        if (cache_dir)
+        {
+            if (cache.initialize() != 0)
+            {
+                trace_close();
+                return 1;
+            }
+            the_visitor.set_cache(&cache);
+        }
+
+        if (the_visitor.initialize() != 0)
+        {
+            trace_close();
+            return 1;
+        }
+        instance.the_visitor = &the_visitor;
+
+        // the whole source is parsed before any code is generated
+        int status = parse();
+
+        status |= the_visitor.terminate();
+        trace_close();
+
+        return status;
+    }
+
+    codegen_visitor the_visitor(source_filename, options);
 
     // initialize the visitor
-    the_visitor.initialize();
-    set_the_visitor(&the_visitor);
+    if (the_visitor.initialize() != 0)
+    {
+        trace_close();
+        return 1;
+    }
+    instance.the_visitor = &the_visitor;
 
-    // parsing routine
-    yyparse();
+    // parsing routine; typing a wrong command does not fail a session
+    int status = parse();
+    if (!source_filename) status = 0;
 
     // clean
-    set_the_visitor(nullptr);
-    the_visitor.terminate();
-    if (fd) { fclose(fd); fd = nullptr; }
+    status |= the_visitor.terminate();
+    trace_close();
 
-    return 0;
+    return status;
 }
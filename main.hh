@@ -3,7 +3,4 @@
 
 #include <cstdio>
 
-extern FILE* yyin;
-extern int yyparse();
-
 #endif
@@ -0,0 +1,113 @@
+#include "object_cache.hh"
+#include "trace.hh"
+
+#include <cstdio>
+#include <chrono>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+
+// Prefix required by pruneCache(), which leaves any other file alone; the
+// files still being written have another one, so that a compiler pruning
+// the same directory cannot remove them before they are renamed.
+static const char* entry_prefix = "llvmcache-kcc-";
+static const char* temp_prefix = "tmp-kcc-";
+
+
+object_cache::object_cache(const std::string& directory, uint64_t size_limit)
+{
+    this->directory = directory;
+    this->size_limit = size_limit;
+}
+
+int object_cache::initialize()
+{
+    if (std::error_code error_code = sys::fs::create_directories(directory))
+    {
+        fprintf(stderr, "[ERROR] Cannot create cache directory \"%s\": %s\n", directory.c_str(), error_code.message().c_str());
+        return 1;
+    }
+    return 0;
+}
+
+std::string object_cache::digest(const std::string& key)
+{
+    auto hash = SHA1::hash(arrayRefFromStringRef(key));
+    return toHex(hash, /*LowerCase*/ true);
+}
+
+std::string object_cache::entry_path(const std::string& digest)
+{
+    return directory + "/" + entry_prefix + digest + ".o";
+}
+
+bool object_cache::lookup(const std::string& digest, std::string& object_code)
+{
+    std::string path = entry_path(digest);
+
+    int fd;
+    if (sys::fs::openFileForRead(path, fd))
+    {
+        ++misses;
+        return false;
+    }
+
+    // Mark it as recently used, access times are not reliable on most mounts.
+    sys::fs::setLastAccessAndModificationTime(fd, std::chrono::system_clock::now());
+
+    auto buffer = MemoryBuffer::getOpenFile(fd, path, -1);
+    sys::fs::closeFile(fd);
+    if (!buffer)
+    {
+        ++misses;
+        return false;
+    }
+
+    object_code = (*buffer)->getBuffer().str();
+    ++hits;
+    return true;
+}
+
+void object_cache::store(const std::string& digest, const std::string& object_code)
+{
+    // Write to a temporary file first, a reader never sees a partial entry.
+    auto temp = sys::fs::TempFile::create(directory + "/" + temp_prefix + "%%%%%%%%.tmp");
+    if (!temp)
+    {
+        consumeError(temp.takeError());
+        return;
+    }
+
+    {
+        raw_fd_ostream dest(temp->FD, /*shouldClose*/ false);
+        dest << object_code;
+    }
+
+    if (Error error = temp->keep(entry_path(digest)))
+    {
+        consumeError(std::move(error));
+        consumeError(temp->discard());
+    }
+}
+
+void object_cache::terminate()
+{
+    CachePruningPolicy policy;
+    policy.Interval = std::chrono::seconds(0); // prune on every run
+    policy.Expiration = std::chrono::seconds(0); // evict by size only
+    policy.MaxSizeBytes = size_limit;
+    pruneCache(directory, policy);
+
+    if (trace_enabled())
+        fprintf(stderr, "[INFO] Cache: %zu hits, %zu misses.\n", hits, misses);
+}
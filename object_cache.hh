@@ -0,0 +1,39 @@
+#ifndef KS_OBJECT_CACHE_HH
+#define KS_OBJECT_CACHE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// On-disk cache of object code, addressed by a digest of everything that
+// went into it. Entries are written atomically so that several compilers
+// can share one directory, and the least recently used ones are evicted
+// when the directory grows past its size limit.
+class object_cache
+{
+public:
+    object_cache(const std::string& directory, uint64_t size_limit);
+
+    int initialize();
+
+    // Digest of a key text, used as the entry name
+    static std::string digest(const std::string& key);
+
+    bool lookup(const std::string& digest, std::string& object_code);
+    void store(const std::string& digest, const std::string& object_code);
+
+    // Evict down to the size limit, and print the counters when tracing
+    void terminate();
+
+    size_t hits {};
+    size_t misses {};
+
+protected:
+    std::string entry_path(const std::string& digest);
+
+    std::string directory;
+    uint64_t size_limit {};
+};
+
+#endif // KS_OBJECT_CACHE_HH
@@ -0,0 +1,375 @@
+#include "parallel_codegen_visitor.hh"
+#include "hash_visitor.hh"
+#include "symbol_table.hh"
+#include "trace.hh"
+
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+
+parallel_codegen_visitor::parallel_codegen_visitor(const char* source_filename, const codegen_options& options, int threads)
+{
+    if (source_filename) this->source_filename = source_filename;
+    this->options = options;
+    if (threads > 0) thread_count = threads;
+}
+
+
+int parallel_codegen_visitor::initialize()
+{
+    commands.clear();
+    defined.clear();
+    named_count = 0;
+    anonymous_count = 0;
+    signatures.clear();
+    keys.clear();
+
+    // Fail early on a bad target rather than in every worker.
+    codegen_visitor probe(source_filename.c_str(), options);
+    return probe.initialize();
+}
+
+
+void parallel_codegen_visitor::set_cache(object_cache* cache)
+{
+    this->cache = cache;
+    partition_size = cache ? 1 : default_partition_size;
+}
+
+
+int parallel_codegen_visitor::terminate()
+{
+    if (options.stop_after < phase_codegen)
+    {
+        if (cache) cache->terminate();
+        return 0;
+    }
+
+    // Partition 0 holds the anonymous expressions, named definitions follow.
+    int partition_count = 1 + (named_count + partition_size - 1) / partition_size;
+    std::vector<partition> partitions(partition_count);
+
+    if (cache)
+    {
+        trace_scope scope("cache", "lookup");
+        std::string prefix = options_key();
+        keys.resize(partition_count);
+        for (int p = 0; p < partition_count; ++p)
+        {
+            if (p == 0 && anonymous_count == 0 && named_count != 0) continue;
+            partition& part = partitions[p];
+            part.digest = object_cache::digest(prefix + keys[p]);
+            part.cached = cache->lookup(part.digest, part.object_code);
+        }
+    }
+
+    std::atomic<int> next_partition {0};
+    auto worker = [&]()
+    {
+        for (int p = next_partition++; p < partition_count; p = next_partition++)
+            if ((p != 0 || anonymous_count != 0 || named_count == 0) && !partitions[p].cached)
+                partitions[p].status = compile_partition(p, partitions[p]);
+    };
+
+    int n = std::min(thread_count, partition_count);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads)
+        t.join();
+
+    int status = 0;
+    for (partition& part : partitions)
+    {
+        status |= part.status;
+        if (options.emit_ir)
+            fwrite(part.ir_text.data(), 1, part.ir_text.size(), stdout);
+
+        // Only what compiled cleanly goes into the cache.
+        if (cache && !part.cached && !part.digest.empty() && part.status == 0 && part.errors == 0)
+            cache->store(part.digest, part.object_code);
+    }
+
+    if (status == 0 && options.emit_object && options.stop_after >= phase_emit && !source_filename.empty())
+    {
+        trace_scope scope("emit", "merge objects");
+        status = write_object(partitions);
+    }
+
+    if (cache)
+        cache->terminate();
+    return status;
+}
+
+
+std::string parallel_codegen_visitor::options_key()
+{
+    // Everything besides the source that changes the object code
+    std::string key = "kcc-object-5 " LLVM_VERSION_STRING " ";
+    key += sys::getDefaultTargetTriple() + " ";
+
+    if (options.cpu == "native")
+    {
+        key += sys::getHostCPUName().str() + " ";
+        StringMap<bool> host_features;
+        if (sys::getHostCPUFeatures(host_features))
+        {
+            std::vector<std::string> features;
+            for (auto& feature : host_features)
+                features.push_back((feature.second ? "+" : "-") + feature.first().str());
+            std::sort(features.begin(), features.end());
+            for (std::string& feature : features)
+                key += feature + ",";
+            key += " ";
+        }
+    }
+    else
+    {
+        key += options.cpu + " ";
+    }
+
+    key += options.features + " ";
+    key += "O" + std::to_string(options.opt_level) + " ";
+    if (options.fp_contract_fast) key += "fp-contract ";
+    if (options.tail_accumulate) key += "tail-accumulate ";
+    if (options.debug_info) key += "g " + source_filename + " ";
+    key += "\n";
+
+    return key;
+}
+
+
+int parallel_codegen_visitor::compile_partition(int p, partition& part)
+{
+    std::string label = std::to_string(p);
+    trace_scope scope("codegen", "partition", label.c_str());
+
+    codegen_visitor the_visitor(source_filename.c_str(), options);
+    if (the_visitor.initialize() != 0)
+        return 1;
+
+    // Replay the source in order: the commands of this partition are compiled,
+    // the other ones only make their functions known, as they would be to a
+    // single visitor at that point of the source.
+    top_level_node root;
+    for (command& cmd : commands)
+    {
+        if (cmd.partition == p)
+        {
+            root.content = cmd.node;
+            if (root.accept(&the_visitor) != 0)
+                ++part.errors; // reported and the function dropped, as in one module
+        }
+        else
+        {
+            the_visitor.declare(cmd.declaration);
+        }
+    }
+
+    return the_visitor.emit(part.object_code, options.emit_ir ? &part.ir_text : nullptr);
+}
+
+
+bool parallel_codegen_visitor::can_merge_objects()
+{
+    return (bool)sys::findProgramByName("ld");
+}
+
+
+int parallel_codegen_visitor::write_object(std::vector<partition>& partitions)
+{
+    std::string output_filename = options.output.empty() ? source_filename + ".o" : options.output;
+    std::vector<std::string> inputs;
+    int status = 0;
+
+    // Partition 0 is left out when it has nothing to compile.
+    std::vector<std::string*> parts;
+    for (partition& part : partitions)
+        if (!part.object_code.empty()) parts.push_back(&part.object_code);
+
+    if (parts.size() == 1)
+    {
+        std::error_code error_code;
+        raw_fd_ostream dest(output_filename, error_code, sys::fs::OF_None);
+        if (error_code)
+        {
+            errs() << "Could not open file: " << error_code.message() << "\n";
+            return 1;
+        }
+        dest << *parts[0];
+        return 0;
+    }
+
+    // Merge the partition objects into one relocatable object.
+    auto linker = sys::findProgramByName("ld");
+    if (!linker)
+    {
+        fprintf(stderr, "[ERROR] Cannot find \"ld\" to merge the objects.\n");
+        return 1;
+    }
+
+    for (std::string* object : parts)
+    {
+        int fd;
+        SmallString<128> path;
+        if (sys::fs::createTemporaryFile("kcc", "o", fd, path))
+        {
+            fprintf(stderr, "[ERROR] Cannot create a temporary object file.\n");
+            status = 1;
+            break;
+        }
+        raw_fd_ostream dest(fd, /*shouldClose*/ true);
+        dest << *object;
+        inputs.push_back(path.str().str());
+    }
+
+    if (status == 0)
+    {
+        std::vector<StringRef> args {*linker, "-r", "-o", output_filename};
+        for (std::string& input : inputs)
+            args.push_back(input);
+
+        std::string error_message;
+        if (sys::ExecuteAndWait(*linker, args, None, {}, 0, 0, &error_message) != 0)
+        {
+            fprintf(stderr, "[ERROR] Merging the objects failed. %s\n", error_message.c_str());
+            status = 1;
+        }
+    }
+
+    for (std::string& input : inputs)
+        sys::fs::remove(input);
+
+    return status;
+}
+
+
+void parallel_codegen_visitor::set_signature(function_declaration_node* node)
+{
+    // one letter per parameter: d for a number, p for an array
+    if (signatures.size() <= (size_t)node->name) signatures.resize(node->name + 1);
+    std::string& signature = signatures[node->name];
+    signature = "(";
+    for (variable_node* argument : *node->arguments)
+        signature += argument->is_array ? 'p' : 'd';
+    signature += ")";
+}
+
+
+void parallel_codegen_visitor::add_key(int p, function_definition_node* node)
+{
+    if (!cache) return;
+
+    // The callees as declared at this point, and an earlier extern of the
+    // function itself, are part of what gets compiled.
+    hash_visitor hasher(&signatures, options.debug_info);
+    int name = node->declaration->name;
+    if ((size_t)name < signatures.size()) hasher.text() = signatures[name];
+    hasher.text() += " ";
+    node->accept(&hasher);
+
+    if (keys.size() <= (size_t)p) keys.resize(p + 1);
+    keys[p] += hasher.text();
+    keys[p] += "\n";
+}
+
+
+int parallel_codegen_visitor::visit(top_level_node* node)
+{
+    if (!node->content) return 0;
+    return node->content->accept(this);
+}
+
+int parallel_codegen_visitor::visit(number_node*)
+{
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(variable_node*)
+{
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(binary_expression_node*)
+{
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(call_function_node*)
+{
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(function_declaration_node* node)
+{
+    commands.push_back({node, node, -1});
+    set_signature(node);
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(function_definition_node* node)
+{
+    int name = node->declaration->name;
+
+    if (name == empty_symbol)
+    {
+        commands.push_back({node, node->declaration, 0});
+        add_key(0, node);
+        ++anonymous_count;
+        return 0;
+    }
+
+    // Catch it here, the partitions would each see one definition only.
+    if (defined.size() <= (size_t)name) defined.resize(name + 1);
+    if (defined[name])
+    {
+        fprintf(stderr, "[ERROR] Redefined function \"%s\".\n", symbol_name(name));
+        return 1;
+    }
+    defined[name] = true;
+
+    int p = 1 + named_count / partition_size;
+    commands.push_back({node, node->declaration, p});
+    add_key(p, node);
+    set_signature(node->declaration);
+    ++named_count;
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(block_node*)
+{
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(assignment_node*)
+{
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(index_node*)
+{
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(if_else_node*)
+{
+    return 0;
+}
+
+int parallel_codegen_visitor::visit(for_loop_node*)
+{
+    return 0;
+}
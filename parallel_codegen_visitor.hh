@@ -0,0 +1,87 @@
+#ifndef KS_PARALLEL_CODEGEN_VISITOR_HH
+#define KS_PARALLEL_CODEGEN_VISITOR_HH
+
+#include <string>
+#include <vector>
+#include "visitor.hh"
+#include "codegen_visitor.hh"
+#include "object_cache.hh"
+
+
+// Collects the commands of the whole source, then splits the function
+// definitions into partitions that are compiled by a pool of threads, each
+// into its own module and object. The objects are merged into <source>.o.
+class parallel_codegen_visitor : public visitor
+{
+public:
+    parallel_codegen_visitor(const char*, const codegen_options&, int threads);
+
+    int initialize();
+    int terminate(); // 1 if a partition or the object could not be made
+
+    // Look every function up in the cache before compiling it; one function
+    // per partition then, so that an edit invalidates only its own entry.
+    void set_cache(object_cache*);
+
+    // The partition objects are merged by the system "ld -r"; false when
+    // there is none to run.
+    static bool can_merge_objects();
+
+    virtual bool retains_ast() { return true; }
+
+    virtual int visit(top_level_node*);
+    virtual int visit(number_node*);
+    virtual int visit(variable_node*);
+    virtual int visit(binary_expression_node*);
+    virtual int visit(call_function_node*);
+    virtual int visit(function_declaration_node*);
+    virtual int visit(function_definition_node*);
+    virtual int visit(block_node*);
+    virtual int visit(assignment_node*);
+    virtual int visit(index_node*);
+    virtual int visit(if_else_node*);
+    virtual int visit(for_loop_node*);
+
+protected:
+    struct command
+    {
+        ast_node* node;
+        function_declaration_node* declaration;
+        int partition; // -1 for an extern, which every partition only declares
+    };
+
+    struct partition
+    {
+        std::string object_code;
+        std::string ir_text;
+        std::string digest; // cache entry
+        int status {};      // emission failed
+        int errors {};      // some function was dropped
+        bool cached {};
+    };
+
+    // Definitions per partition. It does not depend on the number of threads
+    // so that the output is the same however many threads run.
+    static const int default_partition_size = 64;
+
+    int compile_partition(int, partition&);
+    int write_object(std::vector<partition>&);
+    std::string options_key();
+    void set_signature(function_declaration_node*);
+    void add_key(int, function_definition_node*);
+
+    std::string source_filename;
+    codegen_options options;
+    int thread_count {1};
+    int partition_size {default_partition_size};
+    object_cache* cache {nullptr};
+
+    std::vector<command> commands;
+    std::vector<bool> defined; // by symbol id
+    int named_count {};        // named definitions seen so far
+    int anonymous_count {};
+    std::vector<std::string> signatures; // by symbol id as of the current command, empty if undeclared
+    std::vector<std::string> keys;       // by partition, only with a cache
+};
+
+#endif // KS_PARALLEL_CODEGEN_VISITOR_HH
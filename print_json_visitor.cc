@@ -1,19 +1,30 @@
 #include "print_json_visitor.hh"
+#include "symbol_table.hh"
 #include <cstdio>
-#include <string>
 
 
 void print_json_visitor::initialize()
 {
-    fprintf(fd, "{");
-    current_indent = 2;
+    if (!buffer) buffer.reset(new char[buffer_size]);
+    used = 0;
+    depth = 0;
+    first = true;
+    failed = false;
+    begin_array(nullptr); // of the commands
 }
 
-void print_json_visitor::terminate()
+int print_json_visitor::terminate()
 {
-    fprintf(fd, "\b ");
-    current_indent = 0;
-    fprintf(fd, "\n}");
+    end_array();
+    new_line();
+    flush();
+    if (fflush(fd) != 0) failed = true;
+    if (failed)
+    {
+        fprintf(stderr, "[ERROR] Cannot write the JSON output.\n");
+        return 1;
+    }
+    return 0;
 }
 
 void print_json_visitor::set_output_file_descriptor(FILE* _fd)
@@ -21,336 +32,241 @@ void print_json_visitor::set_output_file_descriptor(FILE* _fd)
     fd = _fd;
 }
 
-void print_json_visitor::print_indentation(int indent)
+void print_json_visitor::set_compact(bool _compact)
+{
+    compact = _compact;
+}
+
+void print_json_visitor::flush()
+{
+    if (used && fwrite(buffer.get(), 1, used, fd) != used)
+        failed = true;
+    used = 0;
+}
+
+void print_json_visitor::new_line()
+{
+    if (compact) return;
+    static const char spaces[] = "                                ";
+    put('\n');
+    for (size_t indent = 2 * depth; indent > 0; )
+    {
+        size_t n = indent < sizeof(spaces) - 1 ? indent : sizeof(spaces) - 1;
+        put(spaces, n);
+        indent -= n;
+    }
+}
+
+void print_json_visitor::separate(const char* key)
+{
+    if (depth > 0)
+    {
+        if (!first) put(',');
+        new_line();
+    }
+    first = false;
+
+    if (key)
+    {
+        put('"');
+        write_escaped(key, strlen(key));
+        put(compact ? "\":" : "\": ", compact ? 2 : 3);
+    }
+}
+
+void print_json_visitor::write_escaped(const char* text, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char* run = text; // copied as is up to here
+    for (const char* end = text + length; text != end; ++text)
+    {
+        unsigned char c = *text;
+        if (c != '"' && c != '\\' && c >= 0x20)
+            continue;
+        put(run, text - run);
+        run = text + 1;
+        if (c == '"' || c == '\\')
+        {
+            put('\\');
+            put(c);
+        }
+        else
+        {
+            char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+            put(escape, sizeof(escape));
+        }
+    }
+    put(run, text - run);
+}
+
+void print_json_visitor::begin_object(const char* key, const char* type)
+{
+    separate(key);
+    put('{');
+    ++depth;
+    first = true;
+    write_string("type", type);
+}
+
+void print_json_visitor::end_object()
+{
+    --depth;
+    new_line(); // never empty, it has a type
+    put('}');
+    first = false;
+}
+
+void print_json_visitor::begin_array(const char* key)
+{
+    separate(key);
+    put('[');
+    ++depth;
+    first = true;
+}
+
+void print_json_visitor::end_array()
+{
+    bool empty = first;
+    --depth;
+    if (!empty) new_line();
+    put(']');
+    first = false;
+}
+
+void print_json_visitor::write_string(const char* key, const char* value)
+{
+    write_string(key, value, strlen(value));
+}
+
+void print_json_visitor::write_string(const char* key, const char* value, size_t length)
+{
+    separate(key);
+    put('"');
+    write_escaped(value, length);
+    put('"');
+}
+
+void print_json_visitor::write_literal(const char* key, const char* literal)
 {
-    fprintf(fd, "\n");
-    for (int i = 0; i < indent; ++i)
-        fprintf(fd, " ");
+    separate(key);
+    put(literal, strlen(literal));
+}
+
+void print_json_visitor::write_node(const char* key, ast_node* node)
+{
+    // The node writes its own separator; the key is handed over here.
+    pending_key = key;
+    node->accept(this);
 }
 
 int print_json_visitor::visit(top_level_node* node)
 {
-    node->content->accept(this);
+    if (!node->content) return 0;
+    write_node(nullptr, node->content);
     return 0;
 }
 
 int print_json_visitor::visit(number_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"number_node\",");
-        print_indentation(current_indent);
-        fprintf(fd, "\"value\": \"%s\"", node->value);
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "number_node");
+    write_string("value", node->value, node->length);
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(variable_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"variable_node\",");
-        print_indentation(current_indent);
-        fprintf(fd, "\"name\": \"%s\"", node->name);
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "variable_node");
+    write_string("name", symbol_name(node->name));
+    if (node->is_array)
+        write_literal("array", "true");
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(binary_expression_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"binary_expression_node\",");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"operation\": \"%c\",", node->operation);
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"left\": {");
-        current_indent += 2;
-            node->lhs->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "},");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"right\": {");
-        current_indent += 2;
-            node->rhs->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "}");
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    char operation[2] = {node->operation, '\0'};
+    begin_object(pending_key, "binary_expression_node");
+    write_string("operation", operation);
+    write_node("left", node->lhs);
+    write_node("right", node->rhs);
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(call_function_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"call_function_node\",");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"callee\": \"%s\",", node->callee);
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"arguments\": [ ");
-        current_indent += 2;
-        for (double_linked_list_node<ast_node*>* child = first(node->arguments); child != nullptr; child = next(child))
-        {
-            print_indentation(current_indent);
-            fprintf(fd, "{");
-            current_indent += 2;
-                data(child)->accept(this);
-                fprintf(fd, "\b ");
-            current_indent -= 2;
-            print_indentation(current_indent);
-            fprintf(fd, "},");
-        }
-        fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "]");
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "call_function_node");
+    write_string("callee", symbol_name(node->callee));
+    write_nodes("arguments", node->arguments);
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(function_declaration_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"function_declaration_node\",");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"name\": \"%s\",", node->name);
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"arguments\": [ ");
-        current_indent += 2;
-        for (double_linked_list_node<variable_node*>* child = first(node->arguments); child != nullptr; child = next(child))
-        {
-            print_indentation(current_indent);
-            fprintf(fd, "{");
-            current_indent += 2;
-                data(child)->accept(this);
-                fprintf(fd, "\b ");
-            current_indent -= 2;
-            print_indentation(current_indent);
-            fprintf(fd, "},");
-        }
-        fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "]");
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "function_declaration_node");
+    write_string("name", symbol_name(node->name));
+    write_nodes("arguments", node->arguments);
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(function_definition_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"function_definition_node\",");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"declaration\": {");
-        current_indent += 2;
-            node->declaration->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "},");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"definition\": {");
-        current_indent += 2;
-            node->definition->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "}");
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "function_definition_node");
+    write_node("declaration", node->declaration);
+    write_node("definition", node->definition);
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(block_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"block_node\",");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"expressions\": [ ");
-        current_indent += 2;
-        for (double_linked_list_node<ast_node*>* child = first(node->expressions); child != nullptr; child = next(child))
-        {
-            print_indentation(current_indent);
-            fprintf(fd, "{");
-            current_indent += 2;
-                data(child)->accept(this);
-                fprintf(fd, "\b ");
-            current_indent -= 2;
-            print_indentation(current_indent);
-            fprintf(fd, "},");
-        }
-        fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "]");
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "block_node");
+    write_nodes("expressions", node->expressions);
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(assignment_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"assignment_node\",");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"variable\": \"%s\",", node->variable);
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"RHS\": {");
-        current_indent += 2;
-            node->expression->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "}");
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "assignment_node");
+    write_string("variable", symbol_name(node->variable));
+    write_node("RHS", node->expression);
+    end_object();
+    return 0;
+}
+
+int print_json_visitor::visit(index_node* node)
+{
+    begin_object(pending_key, "index_node");
+    write_string("array", symbol_name(node->array));
+    write_node("index", node->index);
+    if (node->value)
+        write_node("RHS", node->value);
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(if_else_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"if_else_node\",");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"condition\": {");
-        current_indent += 2;
-            node->condition->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "},");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"then\": {");
-        current_indent += 2;
-            node->then_expr->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "},");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"else\": {");
-        current_indent += 2;
-            node->else_expr->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "}");
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "if_else_node");
+    write_node("condition", node->condition);
+    write_node("then", node->then_expr);
+    write_node("else", node->else_expr);
+    end_object();
     return 0;
 }
 
 int print_json_visitor::visit(for_loop_node* node)
 {
-    std::string title("node " + std::to_string(++node_count));
-    print_indentation(current_indent);
-    fprintf(fd, "\"%s\": {", title.c_str());
-    current_indent += 2;
-        print_indentation(current_indent);
-        fprintf(fd, "\"type\": \"for_loop_node\",");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"initialization\": {");
-        current_indent += 2;
-            node->init->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "},");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"condition\": {");
-        current_indent += 2;
-            node->cond->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "},");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"step\": {");
-        current_indent += 2;
-            node->step->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "},");
-        //
-        print_indentation(current_indent);
-        fprintf(fd, "\"expression\": {");
-        current_indent += 2;
-            node->expr->accept(this);
-            fprintf(fd, "\b ");
-        current_indent -= 2;
-        print_indentation(current_indent);
-        fprintf(fd, "}");
-    current_indent -= 2;
-    print_indentation(current_indent);
-    fprintf(fd, "},");
+    begin_object(pending_key, "for_loop_node");
+    write_node("initialization", node->init);
+    write_node("condition", node->cond);
+    write_node("step", node->step);
+    write_node("expression", node->expr);
+    end_object();
     return 0;
 }
@@ -2,16 +2,21 @@
 #define KS_PRINT_JSON_VISITOR_HH
 
 #include <cstdio> // FILE
+#include <cstring>
+#include <memory>
 #include "visitor.hh"
 
 
+// Dumps the AST of the commands as one JSON array with an object per node.
+// The text is streamed through a large buffer written out when it fills up
+// and by terminate(), so the AST of each command can be released as usual.
 class print_json_visitor : public visitor
 {
 public:
     void initialize();
-    void terminate();
+    int terminate(); // 1 if the output could not be written
     void set_output_file_descriptor(FILE*);
-    void print_indentation(int);
+    void set_compact(bool); // no whitespace at all
 
     virtual int visit(top_level_node*);
     virtual int visit(number_node*);
@@ -22,13 +27,59 @@ public:
     virtual int visit(function_definition_node*);
     virtual int visit(block_node*);
     virtual int visit(assignment_node*);
+    virtual int visit(index_node*);
     virtual int visit(if_else_node*);
     virtual int visit(for_loop_node*);
 
 protected:
-    int node_count {};
-    int current_indent {};
+    // Elements of an array are given no key, members of an object one.
+    // Commas go before every element but the first of its container.
+    void begin_object(const char* key, const char* type);
+    void end_object();
+    void begin_array(const char* key);
+    void end_array();
+    void write_string(const char* key, const char* value);
+    void write_string(const char* key, const char* value, size_t length);
+    void write_literal(const char* key, const char* literal); // true, false, null, a number
+    void write_node(const char* key, ast_node*);
+    template <class T> void write_nodes(const char* key, T* nodes)
+    {
+        begin_array(key);
+        for (ast_node* child : *nodes)
+            write_node(nullptr, child);
+        end_array();
+    }
+
+    void separate(const char* key);
+    void write_escaped(const char*, size_t);
+    void new_line();
+    void put(const char* text, size_t length)
+    {
+        if (length > buffer_size - used) flush();
+        if (length > buffer_size)
+        {
+            if (fwrite(text, 1, length, fd) != length) failed = true;
+            return;
+        }
+        memcpy(buffer.get() + used, text, length);
+        used += length;
+    }
+    void put(char c)
+    {
+        if (used == buffer_size) flush();
+        buffer[used++] = c;
+    }
+    void flush();
+
+    static const size_t buffer_size = 1 << 20;
+    std::unique_ptr<char[]> buffer;
+    size_t used {};
+    int depth {};
+    bool first {true}; // nothing written yet in the innermost container
+    const char* pending_key {nullptr}; // of the node visited next
+    bool compact {};
+    bool failed {};
     FILE* fd {stdout};
 };
 
-#endif // KS_PRINT_JSON_VISITOR_HH
\ No newline at end of file
+#endif // KS_PRINT_JSON_VISITOR_HH
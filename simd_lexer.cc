@@ -0,0 +1,275 @@
+#include "simd_lexer.hh"
+#include "symbol_table.hh"
+#include "kal.parser.gen.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KS_SIMD_X86 1
+#endif
+
+
+// Classes of the characters the runs are made of
+static bool is_blank(unsigned char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+static bool is_digit(unsigned char c) { return (unsigned)(c - '0') < 10u; }
+static bool is_word_start(unsigned char c) { return (unsigned)((c | 0x20) - 'a') < 26u || c == '_'; }
+static bool is_word(unsigned char c) { return is_word_start(c) || is_digit(c); }
+
+
+// One bit per byte of a block, the first byte in the lowest bit
+struct block_masks
+{
+    uint32_t blank;
+    uint32_t newline;
+    uint32_t word;  // [a-zA-Z0-9_]
+    uint32_t digit;
+};
+
+#ifdef KS_SIMD_X86
+
+// Unsigned c - low <= high - low, the range test used by the classes above;
+// SSE has no unsigned compare, min_epu8 stands in for it.
+static void classify_sse2(const char* p, block_masks& masks)
+{
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i newline = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    __m128i blank = _mm_or_si128(_mm_or_si128(newline, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i a = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(25)), a);
+    __m128i word = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    masks.blank = _mm_movemask_epi8(blank);
+    masks.newline = _mm_movemask_epi8(newline);
+    masks.word = _mm_movemask_epi8(word);
+    masks.digit = _mm_movemask_epi8(digit);
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char* p, block_masks& masks)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i newline = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    __m256i blank = _mm256_or_si256(_mm256_or_si256(newline, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '))),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+    __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    __m256i a = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(25)), a);
+    __m256i word = _mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    masks.blank = _mm256_movemask_epi8(blank);
+    masks.newline = _mm256_movemask_epi8(newline);
+    masks.word = _mm256_movemask_epi8(word);
+    masks.digit = _mm256_movemask_epi8(digit);
+}
+
+#else
+
+// Byte by byte only, where there is no vector unit to use
+static void classify_none(const char*, block_masks&) {}
+
+#endif // KS_SIMD_X86
+
+
+// The scanning loops, over whole blocks of the given width and then byte by
+// byte for the rest of the text
+template <int width, void (*classify)(const char*, block_masks&)>
+struct block_scanner
+{
+    static constexpr uint32_t all = width == 32 ? ~0u : (1u << width) - 1;
+
+    // Past the blanks at p, counting the lines and columns they span
+    static const char* skip_blanks(const char* p, const char* end, int& line, int& column)
+    {
+        for (; width && end - p >= width; p += width)
+        {
+            block_masks masks;
+            classify(p, masks);
+            uint32_t stop = ~masks.blank & all;
+            int run = stop ? __builtin_ctz(stop) : width;
+            uint32_t newlines = run < 32 ? masks.newline & ((1u << run) - 1) : masks.newline;
+            if (newlines)
+            {
+                line += __builtin_popcount(newlines);
+                column = run - (31 - __builtin_clz(newlines)); // 1 and the blanks after the last newline
+            }
+            else
+            {
+                column += run;
+            }
+            if (stop) return p + run;
+        }
+        for (; p != end && is_blank(*p); ++p)
+        {
+            if (*p == '\n') { ++line; column = 1; }
+            else ++column;
+        }
+        return p;
+    }
+
+    static const char* skip_word(const char* p, const char* end)
+    {
+        for (; width && end - p >= width; p += width)
+        {
+            block_masks masks;
+            classify(p, masks);
+            if (uint32_t stop = ~masks.word & all)
+                return p + __builtin_ctz(stop);
+        }
+        while (p != end && is_word(*p)) ++p;
+        return p;
+    }
+
+    static const char* skip_digits(const char* p, const char* end)
+    {
+        for (; width && end - p >= width; p += width)
+        {
+            block_masks masks;
+            classify(p, masks);
+            if (uint32_t stop = ~masks.digit & all)
+                return p + __builtin_ctz(stop);
+        }
+        while (p != end && is_digit(*p)) ++p;
+        return p;
+    }
+};
+
+struct scanner_kernels
+{
+    const char* name;
+    const char* (*skip_blanks)(const char*, const char*, int&, int&);
+    const char* (*skip_word)(const char*, const char*);
+    const char* (*skip_digits)(const char*, const char*);
+};
+
+template <class S>
+static scanner_kernels kernels_of(const char* name)
+{
+    return {name, S::skip_blanks, S::skip_word, S::skip_digits};
+}
+
+// Picked once, by what the CPU running the compiler supports
+static const scanner_kernels& kernels()
+{
+    static const scanner_kernels selected = []
+    {
+#ifdef KS_SIMD_X86
+        if (__builtin_cpu_supports("avx2"))
+            return kernels_of<block_scanner<32, classify_avx2>>("avx2");
+        return kernels_of<block_scanner<16, classify_sse2>>("sse2");
+#else
+        return kernels_of<block_scanner<0, classify_none>>("none");
+#endif
+    }();
+    return selected;
+}
+
+const char* simd_lexer::instruction_set()
+{
+    return kernels().name;
+}
+
+
+void simd_lexer::reset(const char* text, size_t size)
+{
+    cursor = text;
+    end = text + size;
+    token = text;
+    length = 0;
+    row = 1;
+    col = 1;
+}
+
+static int keyword(const char* text, size_t length)
+{
+    switch (length)
+    {
+    case 2: if (memcmp(text, "if", 2) == 0) return IF; break;
+    case 3: if (memcmp(text, "def", 3) == 0) return DEFINE;
+            if (memcmp(text, "for", 3) == 0) return FOR; break;
+    case 4: if (memcmp(text, "then", 4) == 0) return THEN;
+            if (memcmp(text, "else", 4) == 0) return ELSE; break;
+    case 6: if (memcmp(text, "extern", 6) == 0) return EXTERN; break;
+    }
+    return SYMBOL;
+}
+
+// strtod wants a null-terminated string and would read on past the lexeme
+// (1e5, 0x1), so it is given a copy.
+static double decode_number(const char* text, size_t length)
+{
+    char digits[64];
+    if (length < sizeof(digits))
+    {
+        memcpy(digits, text, length);
+        digits[length] = '\0';
+        return strtod(digits, nullptr);
+    }
+    return strtod(std::string(text, length).c_str(), nullptr);
+}
+
+int simd_lexer::next(YYSTYPE* value)
+{
+    const scanner_kernels& scan = kernels();
+    for (;;)
+    {
+        cursor = scan.skip_blanks(cursor, end, row, col);
+        token = cursor;
+        length = 0;
+        if (cursor == end)
+            return 0;
+
+        const char* p = cursor;
+        unsigned char c = *p++;
+        ++col; // every rule counts one, as YY_USER_ACTION does
+
+        if (c == '#')
+        {
+            // [#].*$ only matches before a newline: a comment on the last
+            // line of a file without one is an unexpected # and its text.
+            if (const char* newline = (const char*)memchr(p, '\n', end - p))
+            {
+                cursor = newline;
+                continue;
+            }
+        }
+        else if (is_word_start(c))
+        {
+            p = scan.skip_word(p, end);
+            length = p - token;
+            cursor = p;
+            int kind = keyword(token, length);
+            if (kind == SYMBOL) value->sym = intern_symbol(token, length);
+            return kind;
+        }
+        else if (is_digit(c) || (c == '.' && p != end && is_digit(*p)))
+        {
+            // [0-9]+\.?|[0-9]*\.[0-9]+, the longest: the digits, a dot and
+            // the digits after it
+            if (c != '.') p = scan.skip_digits(p, end);
+            if (c != '.' && p != end && *p == '.') ++p;
+            if (p[-1] == '.') p = scan.skip_digits(p, end);
+            length = p - token;
+            cursor = p;
+            value->number.value = decode_number(token, length);
+            value->number.lexeme = token;
+            value->number.length = length;
+            return NUMBER;
+        }
+        else if (c && strchr("+-*/=<>|&(){};,[]", c))
+        {
+            length = 1;
+            cursor = p;
+            return c;
+        }
+
+        length = 1;
+        cursor = p;
+        value->str = "Unexpected token";
+        return ERROR;
+    }
+}
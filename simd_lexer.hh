@@ -0,0 +1,39 @@
+#ifndef KS_SIMD_LEXER_HH
+#define KS_SIMD_LEXER_HH
+
+#include <cstddef>
+#include <string>
+
+union YYSTYPE;
+
+
+// Hand-written scanner for mapped sources (--lexer=simd), a drop-in for the
+// one flex generates: the same tokens, values and positions, column counted
+// once per rule as YY_USER_ACTION does. Runs of blanks, identifiers and
+// digits are classified 16 bytes at a time with SSE2, 32 with AVX2 where
+// the CPU has it, and the characters in between one by one. The text is
+// never written to, the lexemes of the numbers point into it.
+class simd_lexer
+{
+public:
+    void reset(const char* text, size_t size);
+
+    int next(YYSTYPE*); // the next token as yylex returns it, 0 at the end
+
+    int line() const { return row; }
+    int column() const { return col; }
+    std::string text() const { return std::string(token, length); } // of the last token
+
+    static const char* instruction_set(); // used on this CPU: avx2, sse2 or none
+
+protected:
+    const char* cursor {nullptr};
+    const char* end {nullptr};
+    const char* token {""};
+    size_t length {};
+    int row {1};
+    int col {1};
+};
+
+
+#endif // KS_SIMD_LEXER_HH
@@ -0,0 +1,66 @@
+#ifndef KS_SMALL_VECTOR_HH
+#define KS_SMALL_VECTOR_HH
+
+#include <stddef.h>
+#include <string.h>
+#include <new>
+#include <type_traits>
+#include "arena.hh"
+
+
+// Contiguous sequence with room for N elements inline. Growing doubles the
+// capacity into the arena and abandons the old storage to it, so appending
+// and size() are O(1) and nothing has to be freed one by one.
+template <class T, size_t N = 4>
+struct small_vector
+{
+    static_assert(std::is_trivially_copyable<T>::value, "elements are relocated with memcpy");
+
+    explicit small_vector(arena* pool) : pool(pool) {}
+
+    small_vector(const small_vector&) = delete;
+    small_vector& operator=(const small_vector&) = delete;
+
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    T& operator[](size_t i) { return elements[i]; }
+    const T& operator[](size_t i) const { return elements[i]; }
+
+    T* begin() { return elements; }
+    T* end() { return elements + length; }
+    const T* begin() const { return elements; }
+    const T* end() const { return elements + length; }
+
+    void push_back(const T& value)
+    {
+        if (length == capacity) grow();
+        elements[length++] = value;
+    }
+
+protected:
+    void grow()
+    {
+        size_t new_capacity = capacity * 2;
+        T* storage = static_cast<T*>(pool->allocate(new_capacity * sizeof(T), alignof(T)));
+        memcpy(storage, elements, length * sizeof(T));
+        elements = storage;
+        capacity = new_capacity;
+    }
+
+    arena* pool {nullptr};
+    T* elements {inline_elements};
+    size_t length {};
+    size_t capacity {N};
+    T inline_elements[N];
+};
+
+template <class T, size_t N = 4>
+inline small_vector<T, N>* make_small_vector(arena* pool)
+{
+    void* memory = pool->allocate(sizeof(small_vector<T, N>), alignof(small_vector<T, N>));
+    return new (memory) small_vector<T, N>(pool);
+}
+
+
+#endif // KS_SMALL_VECTOR_HH
@@ -0,0 +1,189 @@
+#include "symbol_table.hh"
+#include "arena.hh"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+
+// Open-addressing hash table over the interned names. The names live in
+// an arena of their own which, unlike the AST arena, is never reset.
+//
+// Several compiler instances may intern at once, so the table is locked;
+// looking a name up by id is not, it is done for every function and error
+// message. The names are indexed through pages that never move once
+// published, and an id is only known after its name has been stored.
+// Every thread also remembers the names it interned last, see
+// intern_symbol(), so the lexers of -j seldom take the lock.
+struct symbol_table
+{
+    symbol_table();
+
+    int find(const char*, size_t, uint32_t, size_t&) const;
+    int insert(const char*, size_t, uint32_t);
+    void grow();
+    const char* name(int id) const { return pages[id >> page_bits].load(std::memory_order_acquire)[id & (page_size - 1)]; }
+
+    static const int page_bits = 12;
+    static const int page_size = 1 << page_bits;
+    static const int max_pages = 1 << 14; // 64M names
+
+    std::mutex mutex;
+    arena storage;
+    std::atomic<const char**> pages[max_pages] {};
+    std::atomic<size_t> count {};
+    std::vector<uint32_t> lengths;
+    std::vector<uint32_t> hashes;
+    std::vector<int> slots; // -1 for empty, power of two sized
+};
+
+
+static uint32_t hash_name(const char* text, size_t length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+symbol_table::symbol_table() : slots(1024, -1)
+{
+    insert("", 0, hash_name("", 0)); // empty_symbol
+}
+
+int symbol_table::find(const char* text, size_t length, uint32_t hash, size_t& slot) const
+{
+    size_t mask = slots.size() - 1;
+
+    for (slot = hash & mask; slots[slot] != -1; slot = (slot + 1) & mask)
+    {
+        int id = slots[slot];
+        if (hashes[id] == hash && lengths[id] == length && memcmp(name(id), text, length) == 0)
+            return id;
+    }
+
+    return -1;
+}
+
+int symbol_table::insert(const char* text, size_t length, uint32_t hash)
+{
+    size_t slot;
+
+    int id = find(text, length, hash, slot);
+    if (id != -1) return id;
+
+    char* name = static_cast<char*>(storage.allocate(length + 1, 1));
+    memcpy(name, text, length);
+    name[length] = '\0';
+
+    id = (int)count.load(std::memory_order_relaxed);
+    if ((id & (page_size - 1)) == 0)
+    {
+        if ((id >> page_bits) == max_pages)
+        {
+            fprintf(stderr, "[ERROR] Too many names.\n");
+            abort();
+        }
+        pages[id >> page_bits].store(new const char*[page_size], std::memory_order_release);
+    }
+    pages[id >> page_bits].load(std::memory_order_relaxed)[id & (page_size - 1)] = name;
+    lengths.push_back((uint32_t)length);
+    hashes.push_back(hash);
+    slots[slot] = id;
+    count.store(id + 1, std::memory_order_release);
+
+    // Keep the load factor under 1/2.
+    if (lengths.size() * 2 > slots.size()) grow();
+
+    return id;
+}
+
+void symbol_table::grow()
+{
+    std::vector<int> old_slots(slots.size() * 2, -1);
+    old_slots.swap(slots);
+
+    size_t mask = slots.size() - 1;
+    for (int id : old_slots)
+    {
+        if (id == -1) continue;
+        size_t slot = hashes[id] & mask;
+        while (slots[slot] != -1) slot = (slot + 1) & mask;
+        slots[slot] = id;
+    }
+}
+
+
+static symbol_table& get_symbol_table()
+{
+    static symbol_table table;
+    return table;
+}
+
+// Ids of the names interned on a thread, direct-mapped by hash. An entry
+// never goes stale: names are not removed and ids not reused. The names are
+// compared through symbol_name(), which takes no lock either.
+struct symbol_cache
+{
+    static const int size = 1024;
+    uint32_t hashes[size];
+    int ids[size]; // id + 1, 0 for an empty entry
+};
+
+static thread_local symbol_cache __symbol_cache;
+
+int intern_symbol(const char* text, size_t length)
+{
+    uint32_t hash = hash_name(text, length);
+    symbol_cache& cache = __symbol_cache;
+    int entry = hash & (symbol_cache::size - 1);
+    if (cache.ids[entry] != 0 && cache.hashes[entry] == hash)
+    {
+        int id = cache.ids[entry] - 1;
+        const char* name = symbol_name(id);
+        if (strnlen(name, length + 1) == length && memcmp(name, text, length) == 0)
+            return id;
+    }
+
+    symbol_table& table = get_symbol_table();
+    int id;
+    {
+        std::lock_guard<std::mutex> lock(table.mutex);
+        id = table.insert(text, length, hash);
+    }
+    cache.hashes[entry] = hash;
+    cache.ids[entry] = id + 1;
+    return id;
+}
+
+int intern_symbol(const char* text)
+{
+    return intern_symbol(text, strlen(text));
+}
+
+int find_symbol(const char* text, size_t length)
+{
+    symbol_table& table = get_symbol_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    size_t slot;
+    return table.find(text, length, hash_name(text, length), slot);
+}
+
+const char* symbol_name(int id)
+{
+    return get_symbol_table().name(id);
+}
+
+size_t symbol_count()
+{
+    return get_symbol_table().count.load(std::memory_order_acquire);
+}
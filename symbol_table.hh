@@ -0,0 +1,28 @@
+#ifndef KS_SYMBOL_TABLE_HH
+#define KS_SYMBOL_TABLE_HH
+
+#include <stddef.h>
+
+
+// Identifiers are interned once by the lexer and referred to by a dense
+// integer id from then on. Ids and names stay valid for the whole run.
+// The table is shared by every compiler instance, on any thread.
+
+// Id of the empty name (anonymous expressions)
+const int empty_symbol = 0;
+
+// Intern a name, returning its id
+int intern_symbol(const char* text, size_t length);
+int intern_symbol(const char* text);
+
+// Id of an already interned name, or -1
+int find_symbol(const char* text, size_t length);
+
+// Null-terminated name of an id
+const char* symbol_name(int id);
+
+// Number of ids handed out so far (ids are [0, count))
+size_t symbol_count();
+
+
+#endif // KS_SYMBOL_TABLE_HH
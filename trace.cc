@@ -0,0 +1,120 @@
+#include "trace.hh"
+
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+bool trace_on = false;
+
+static FILE* trace_file = nullptr;
+static std::chrono::steady_clock::time_point trace_origin;
+static std::mutex trace_mutex;
+static std::vector<std::string> trace_events; // formatted, in completion order
+
+
+// Small sequential ids read better in the viewer than native thread ids.
+static int trace_thread_id()
+{
+    static std::atomic<int> next_id {0};
+    static thread_local int id = ++next_id;
+    return id;
+}
+
+static void append_escaped(std::string& out, const char* text)
+{
+    for (; *text; ++text)
+    {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+}
+
+
+int trace_open(const char* filename)
+{
+    trace_file = fopen(filename, "w");
+    if (!trace_file)
+    {
+        fprintf(stderr, "[ERROR] Cannot open file \"%s\".\n", filename);
+        return 1;
+    }
+
+    trace_origin = std::chrono::steady_clock::now();
+    trace_thread_id(); // the thread opening the trace is thread 1
+    trace_on = true;
+    return 0;
+}
+
+int trace_close()
+{
+    if (!trace_on) return 0;
+    trace_on = false;
+
+    fprintf(trace_file, "{\"traceEvents\": [\n");
+    for (size_t i = 0; i < trace_events.size(); ++i)
+        fprintf(trace_file, "%s%s\n", trace_events[i].c_str(), i + 1 < trace_events.size() ? "," : "");
+    fprintf(trace_file, "],\n\"displayTimeUnit\": \"ms\"}\n");
+
+    int status = ferror(trace_file) ? 1 : 0;
+    fclose(trace_file);
+    trace_file = nullptr;
+    trace_events.clear();
+    return status;
+}
+
+uint64_t trace_now()
+{
+    auto elapsed = std::chrono::steady_clock::now() - trace_origin;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+void trace_event(const char* category, const char* name, const char* detail,
+    uint64_t start, uint64_t end, const char* args)
+{
+    if (!trace_on) return;
+
+    std::string event = "{\"ph\": \"X\", \"pid\": 1, \"tid\": ";
+    event += std::to_string(trace_thread_id());
+    event += ", \"ts\": ";
+    event += std::to_string(start);
+    event += ", \"dur\": ";
+    event += std::to_string(end - start);
+    event += ", \"cat\": \"";
+    append_escaped(event, category);
+    event += "\", \"name\": \"";
+    append_escaped(event, name);
+    if (detail)
+    {
+        event += ' ';
+        append_escaped(event, detail);
+    }
+    event += '"';
+    if (args)
+    {
+        event += ", \"args\": {";
+        event += args;
+        event += '}';
+    }
+    event += '}';
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_events.push_back(std::move(event));
+}
@@ -0,0 +1,61 @@
+#ifndef KS_TRACE_HH
+#define KS_TRACE_HH
+
+#include <stdint.h>
+
+
+// Timeline of the compiler phases in the Chrome trace-event format, written
+// by --trace=<file> and viewed in chrome://tracing or Perfetto. Recording is
+// off unless trace_open() succeeded; scopes then cost a branch.
+
+// Start recording; the events are written to the file by trace_close()
+int trace_open(const char* filename);
+int trace_close();
+
+extern bool trace_on;
+
+inline bool trace_enabled()
+{
+    return trace_on;
+}
+
+// Microseconds since trace_open()
+uint64_t trace_now();
+
+// Record a complete event. The name is "<name> <detail>" when detail is given;
+// args is the body of a JSON object, e.g. "\"tokens\": 12".
+void trace_event(const char* category, const char* name, const char* detail,
+    uint64_t start, uint64_t end, const char* args = nullptr);
+
+
+// Records an event for the lifetime of the scope
+class trace_scope
+{
+public:
+    trace_scope(const char* category, const char* name, const char* detail = nullptr)
+    {
+        if (!trace_enabled()) return;
+        this->category = category;
+        this->name = name;
+        this->detail = detail;
+        start = trace_now();
+    }
+
+    ~trace_scope()
+    {
+        if (category)
+            trace_event(category, name, detail, start, trace_now());
+    }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+protected:
+    const char* category {nullptr};
+    const char* name {nullptr};
+    const char* detail {nullptr};
+    uint64_t start {};
+};
+
+
+#endif // KS_TRACE_HH
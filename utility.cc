@@ -1,11 +1,25 @@
 #include "utility.hh"
+#include "arena.hh"
 #include <cstring>
 
 
 const char* make_c_str(const char* text)
 {
-    int len = strlen(text);
-    char* copy = new char[len + 1];
-    strcpy(copy, text);
+    size_t len = strlen(text);
+    char* copy = static_cast<char*>(get_ast_arena()->allocate(len + 1, 1));
+    memcpy(copy, text, len + 1);
     return copy;
 }
+
+
+static thread_local FILE* __diagnostic_stream = nullptr;
+
+FILE* diagnostic_stream()
+{
+    return __diagnostic_stream ? __diagnostic_stream : stderr;
+}
+
+void set_diagnostic_stream(FILE* stream)
+{
+    __diagnostic_stream = stream;
+}
@@ -1,8 +1,15 @@
 #ifndef KS_UTILITY_HH
 #define KS_UTILITY_HH
 
+#include <cstdio>
 
+// Copy a lexeme into the AST arena (released with the command)
 const char* make_c_str(const char*);
 
+// Where the diagnostics of the calling thread go: stderr, unless a job of
+// the batch driver collects them to print them with their source
+FILE* diagnostic_stream();
+void set_diagnostic_stream(FILE*); // nullptr for stderr
+
 
 #endif // KS_UTILITY_HH
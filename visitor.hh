@@ -17,12 +17,13 @@ public:
     virtual int visit(function_definition_node*) = 0;
     virtual int visit(block_node*) = 0;
     virtual int visit(assignment_node*) = 0;
+    virtual int visit(index_node*) = 0;
     virtual int visit(if_else_node*) = 0;
     virtual int visit(for_loop_node*) = 0;
-};
-
-void set_the_visitor(visitor*);
 
-visitor* get_the_visitor();
+    // Whether the visitor holds on to the nodes of a command after visiting
+    // it, in which case the parser keeps the AST arena until the end.
+    virtual bool retains_ast() { return false; }
+};
 
 #endif // KS_VISITOR_HH
@@ -0,0 +1,68 @@
+#include "work_pool.hh"
+
+#include <algorithm>
+#include <thread>
+
+
+work_pool::work_pool(int threads)
+{
+    if (threads > 0) thread_count = threads;
+}
+
+
+void work_pool::run(const std::vector<int>& order, const std::function<void(int)>& job)
+{
+    int n = std::min<int>(thread_count, order.size());
+    if (n == 0) return;
+
+    queues.clear();
+    for (int i = 0; i < n; ++i)
+        queues.emplace_back(new queue);
+    for (size_t i = 0; i < order.size(); ++i)
+        queues[i % n]->jobs.push_back(order[i]);
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n; ++i)
+        threads.emplace_back(&work_pool::work, this, i, std::cref(job));
+    work(0, job);
+    for (std::thread& t : threads)
+        t.join();
+}
+
+
+void work_pool::work(int self, const std::function<void(int)>& job)
+{
+    for (int i; take(self, i); )
+        job(i);
+}
+
+
+bool work_pool::take(int self, int& job)
+{
+    {
+        queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    // No job is ever added back, so one pass over the others is enough.
+    int n = queues.size();
+    for (int k = 1; k < n; ++k)
+    {
+        queue& other = *queues[(self + k) % n];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.jobs.empty())
+        {
+            job = other.jobs.back();
+            other.jobs.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,37 @@
+#ifndef KS_WORK_POOL_HH
+#define KS_WORK_POOL_HH
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// Runs jobs given by index on a number of threads. The jobs are dealt out
+// round-robin in the order given, so the largest should come first; every
+// thread takes from the front of its own queue and, once it is empty, steals
+// from the back of the others', so a few long jobs do not leave threads idle.
+class work_pool
+{
+public:
+    explicit work_pool(int threads);
+
+    // Returns once job(i) has run for every i of order
+    void run(const std::vector<int>& order, const std::function<void(int)>& job);
+
+protected:
+    struct queue
+    {
+        std::mutex mutex;
+        std::deque<int> jobs;
+    };
+
+    bool take(int self, int& job);
+    void work(int self, const std::function<void(int)>& job);
+
+    int thread_count {1};
+    std::vector<std::unique_ptr<queue>> queues;
+};
+
+#endif // KS_WORK_POOL_HH